@@ -0,0 +1,158 @@
+#include "ConvolutionReverb.hpp"
+
+#include "load_wav.hpp"
+#include "load_opus.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <cassert>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define REVERB_SSE
+#endif
+
+//helper: load an impulse response by file extension:
+static std::vector< float > load_impulse(std::string const &filename) {
+	std::vector< float > impulse;
+	if (filename.size() >= 4 && filename.substr(filename.size()-4) == ".wav") {
+		load_wav(filename, &impulse);
+	} else if (filename.size() >= 5 && filename.substr(filename.size()-5) == ".opus") {
+		load_opus(filename, &impulse);
+	} else {
+		throw std::runtime_error("Impulse response '" + filename + "' doesn't end in either \".wav\" or \".opus\" -- unsure how to load.");
+	}
+	return impulse;
+}
+
+//helper: check a partition size (0 meaning the current block size):
+static uint32_t partition_size_for(uint32_t partition) {
+	if (partition == 0) partition = Sound::block_size();
+	if (partition < 2 || (partition & (partition - 1)) != 0) {
+		throw std::runtime_error("ConvolutionReverb partition size " + std::to_string(partition) + " isn't a power of two.");
+	}
+	return partition;
+}
+
+ConvolutionReverb::ConvolutionReverb(std::string const &filename, float wet_, float dry_, uint32_t partition) : ConvolutionReverb(load_impulse(filename), wet_, dry_, partition) {
+}
+
+ConvolutionReverb::ConvolutionReverb(std::vector< float > const &impulse, float wet_, float dry_, uint32_t partition) : wet(wet_), dry(dry_), partition_size(partition_size_for(partition)), fft(2 * partition_size) {
+	setup(impulse);
+}
+
+void ConvolutionReverb::setup(std::vector< float > const &impulse) {
+	partitions = std::max(1U, uint32_t((impulse.size() + partition_size - 1) / partition_size));
+
+	//transform each partition of the impulse response, padded to the transform size:
+	uint32_t bins = fft.spectrum_floats();
+	impulse_spectra.assign(size_t(partitions) * bins, 0.0f);
+	std::vector< float > padded(2 * partition_size);
+	for (uint32_t p = 0; p < partitions; ++p) {
+		std::fill(padded.begin(), padded.end(), 0.0f);
+		size_t begin = size_t(p) * partition_size;
+		size_t end = std::min(impulse.size(), begin + partition_size);
+		if (begin < end) std::copy(impulse.begin() + begin, impulse.begin() + end, padded.begin());
+		fft.forward(padded.data(), impulse_spectra.data() + size_t(p) * bins);
+	}
+
+	for (Channel &channel : channels) {
+		channel.input.assign(2 * partition_size, 0.0f);
+		channel.history.assign(size_t(partitions) * bins, 0.0f);
+		channel.wet.assign(partition_size, 0.0f);
+	}
+	newest = 0;
+	filled = 0;
+	accumulated.assign(bins, 0.0f);
+	output.assign(2 * partition_size, 0.0f);
+}
+
+//helper: acc += a * b for split spectra (see RealFFT) of 'bins' complex values:
+static void multiply_add(float const *a, float const *b, float *acc, uint32_t bins) {
+	float const *a_re = a, *a_im = a + bins;
+	float const *b_re = b, *b_im = b + bins;
+	float *acc_re = acc, *acc_im = acc + bins;
+	uint32_t i = 0;
+#ifdef REVERB_SSE
+	for (; i + 4 <= bins; i += 4) {
+		__m128 ar = _mm_loadu_ps(a_re + i), ai = _mm_loadu_ps(a_im + i);
+		__m128 br = _mm_loadu_ps(b_re + i), bi = _mm_loadu_ps(b_im + i);
+		__m128 re = _mm_sub_ps(_mm_mul_ps(ar, br), _mm_mul_ps(ai, bi));
+		__m128 im = _mm_add_ps(_mm_mul_ps(ar, bi), _mm_mul_ps(ai, br));
+		_mm_storeu_ps(acc_re + i, _mm_add_ps(_mm_loadu_ps(acc_re + i), re));
+		_mm_storeu_ps(acc_im + i, _mm_add_ps(_mm_loadu_ps(acc_im + i), im));
+	}
+#endif
+	for (; i < bins; ++i) {
+		acc_re[i] += a_re[i] * b_re[i] - a_im[i] * b_im[i];
+		acc_im[i] += a_re[i] * b_im[i] + a_im[i] * b_re[i];
+	}
+}
+
+//convolve a full partition of input (overlap-save), leaving the result in each channel's 'wet':
+void ConvolutionReverb::convolve_partition() {
+	uint32_t bins = fft.spectrum_floats();
+	//the history ring moves back one partition, so history partition (newest + p) % partitions is from p partitions ago:
+	newest = (newest + partitions - 1) % partitions;
+	for (Channel &channel : channels) {
+		fft.forward(channel.input.data(), channel.history.data() + size_t(newest) * bins);
+
+		std::fill(accumulated.begin(), accumulated.end(), 0.0f);
+		for (uint32_t p = 0; p < partitions; ++p) {
+			uint32_t h = (newest + p) % partitions;
+			multiply_add(channel.history.data() + size_t(h) * bins, impulse_spectra.data() + size_t(p) * bins, accumulated.data(), bins / 2);
+		}
+		fft.inverse(accumulated.data(), output.data());
+
+		//the first half of the output wrapped around (circular convolution), so only the second half is kept:
+		std::copy(output.begin() + partition_size, output.end(), channel.wet.begin());
+		//this partition is the previous partition next time:
+		std::copy(channel.input.begin() + partition_size, channel.input.end(), channel.input.begin());
+	}
+}
+
+void ConvolutionReverb::process(float *samples, uint32_t frames) {
+	//(read once, so the whole block is mixed with the same levels)
+	float wet_gain = wet.load(std::memory_order_relaxed);
+	float dry_gain = dry.load(std::memory_order_relaxed);
+
+	while (frames > 0) {
+		uint32_t count = std::min(frames, partition_size - filled);
+		//(a whole partition at once can be convolved and mixed right away; otherwise the reverb runs a partition behind)
+		bool whole = (filled == 0 && count == partition_size);
+
+		for (uint32_t c = 0; c < 2; ++c) {
+			float *input = channels[c].input.data() + partition_size + filled;
+			for (uint32_t i = 0; i < count; ++i) {
+				input[i] = samples[2*i+c];
+			}
+		}
+		if (!whole) {
+			for (uint32_t c = 0; c < 2; ++c) {
+				float const *reverb = channels[c].wet.data() + filled;
+				for (uint32_t i = 0; i < count; ++i) {
+					samples[2*i+c] = dry_gain * samples[2*i+c] + wet_gain * reverb[i];
+				}
+			}
+		}
+
+		filled += count;
+		if (filled == partition_size) {
+			convolve_partition();
+			filled = 0;
+			if (whole) {
+				for (uint32_t c = 0; c < 2; ++c) {
+					float *reverb = channels[c].wet.data();
+					for (uint32_t i = 0; i < count; ++i) {
+						samples[2*i+c] = dry_gain * samples[2*i+c] + wet_gain * reverb[i];
+					}
+					//(already played, so it mustn't be played again if blocks get shorter)
+					std::fill(channels[c].wet.begin(), channels[c].wet.end(), 0.0f);
+				}
+			}
+		}
+
+		samples += 2 * count;
+		frames -= count;
+	}
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+/*
+ * ConvolutionReverb is a bus effect (see Sound::Bus::set_effects) that convolves a bus's audio with an
+ * impulse response -- e.g., a recording of a room's response to a click -- so it sounds like it's playing in that room:
+ *
+ * static ConvolutionReverb hall(data_path("hall.wav"), 0.25f);
+ * Sound::get_bus("master").set_effects({&hall});
+ *
+ * Convolving directly with a real room's response is far too slow for the audio thread (a two-second response
+ * takes 96000 multiply-adds per output sample), so this uses uniformly-partitioned convolution:
+ * the response is cut into partitions one block long, each is transformed once (see RealFFT), and every block
+ * costs two transforms per channel plus one spectrum multiply-add per partition -- the same amount of work every block.
+ *
+ * The response is mono (as loaded by load_wav and load_opus), and is applied to the left and right channels separately.
+ *
+ */
+
+#include "Sound.hpp"
+#include "RealFFT.hpp"
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+struct ConvolutionReverb : Sound::Effect {
+	//impulse response from a '.wav' or '.opus' file; throws on error:
+	ConvolutionReverb(std::string const &filename, float wet = 0.25f, float dry = 1.0f, uint32_t partition = 0);
+	//impulse response from 48kHz mono audio:
+	ConvolutionReverb(std::vector< float > const &impulse, float wet = 0.25f, float dry = 1.0f, uint32_t partition = 0);
+	//'partition' is the partition size in samples (a power of two; 0 means the current Sound::block_size()):
+	// blocks a multiple of the partition size long are processed with no delay;
+	// shorter blocks delay the reverb (but not the dry signal) by one partition.
+
+	virtual void process(float *samples, uint32_t frames) override;
+
+	//output is dry * input + wet * (input convolved with the impulse response):
+	// (may be changed from the game thread at any time -- e.g., 'hall.wet = 0.5f;' -- and take effect on the next block)
+	std::atomic< float > wet;
+	std::atomic< float > dry;
+
+	//internals:
+	uint32_t partition_size = 0;
+	uint32_t partitions = 0; //number of partitions the impulse response was cut into
+	RealFFT fft; //(of 2 * partition_size samples)
+	std::vector< float > impulse_spectra; //spectrum of each partition of the impulse response (padded with zeros)
+	struct Channel {
+		std::vector< float > input; //previous and current partition of input (2 * partition_size samples)
+		std::vector< float > history; //spectra of the last 'partitions' partitions of input (a ring; see 'newest')
+		std::vector< float > wet; //convolved audio for the last partition of input
+	};
+	Channel channels[2];
+	uint32_t newest = 0; //partition in each channel's history that holds the newest spectrum
+	uint32_t filled = 0; //samples of the current partition received so far
+	std::vector< float > accumulated; //(scratch space for the output spectrum)
+	std::vector< float > output; //(scratch space for the output)
+
+	void setup(std::vector< float > const &impulse);
+	void convolve_partition();
+};
@@ -2,6 +2,7 @@
 
 #include <array>
 #include <list>
+#include <vector>
 #include <cassert>
 
 namespace {
@@ -9,6 +10,10 @@ namespace {
 		static std::array< std::list< std::function< void() > >, MaxLoadTag > load_lists;
 		return load_lists;
 	}
+	std::vector< std::shared_future< void > > &get_load_futures() {
+		static std::vector< std::shared_future< void > > load_futures;
+		return load_futures;
+	}
 }
 
 void add_load_function(LoadTag tag, std::function< void() > const &fn) {
@@ -17,6 +22,10 @@ void add_load_function(LoadTag tag, std::function< void() > const &fn) {
 	load_lists[tag].emplace_back(fn);
 }
 
+void add_load_future(std::shared_future< void > const &future) {
+	get_load_futures().emplace_back(future);
+}
+
 void call_load_functions() {
 	static bool has_been_called = false;
 	assert(!has_been_called && "call_load_functions should only be called *once*");
@@ -28,5 +37,12 @@ void call_load_functions() {
 			(*fn_list.begin())(); //call first function in the list
 			fn_list.pop_front(); //remove from list
 		}
+		//wait for any work handed off by this tag's functions:
+		// (the vector is swapped out so that nothing is left behind if get() throws)
+		std::vector< std::shared_future< void > > futures;
+		futures.swap(get_load_futures());
+		for (auto const &future : futures) {
+			future.get();
+		}
 	}
 }
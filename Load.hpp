@@ -20,9 +20,19 @@
  * These functions are grouped by 'tags', which allow some sequencing of calls.
  * (particularly, this is useful for loading large data blobs [e.g. Meshes] before looking up individual elements within them.)
  *
+ * Loading functions may also hand slow work off to other threads and pass the resulting future to add_load_future();
+ * call_load_functions() waits for all of a tag's futures before moving on to the next tag. E.g., to decode samples in parallel:
+ *
+ * Load< Sound::Sample > music_sample(LoadTagDefault, []() -> Sound::Sample const * {
+ *     Sound::Sample *sample = new Sound::Sample();
+ *     add_load_future(sample->load_async(data_path("music.opus")));
+ *     return sample;
+ * });
+ *
  */
 
 #include <functional>
+#include <future>
 #include <stdexcept>
 #include <cstdint>
 
@@ -38,6 +48,10 @@ enum LoadTag : uint32_t {
 // (only call *before* "call_load_functions()")
 void add_load_function(LoadTag tag, std::function< void() > const &fn);
 
+//Have call_load_functions() wait for 'future' before moving on to the next tag (and before returning):
+// (only call from inside a loading function; if the future holds an exception, call_load_functions() rethrows it)
+void add_load_future(std::shared_future< void > const &future);
+
 //Call all loading functions:
 // (loading functions may throw exceptions if they fail.)
 // (only call *once*)
@@ -119,7 +119,18 @@ const game_names = [
 	maek.CPP('main.cpp'),
 	maek.CPP('LitColorTextureProgram.cpp'),
 	//maek.CPP('ColorTextureProgram.cpp'),  //not used right now, but you might want it
+];
+
+const sound_names = [
 	maek.CPP('Sound.cpp'),
+	maek.CPP('ima_adpcm.cpp'),
+	maek.CPP('resample.cpp'),
+	maek.CPP('WorkerPool.cpp'),
+	maek.CPP('pcm_cache.cpp'),
+	maek.CPP('pcm.cpp'),
+	maek.CPP('sound_capture.cpp'),
+	maek.CPP('RealFFT.cpp'),
+	maek.CPP('ConvolutionReverb.cpp'),
 	maek.CPP('load_wav.cpp'),
 	maek.CPP('load_opus.cpp')
 ];
@@ -151,13 +162,31 @@ const show_scene_names = [
 	maek.CPP('ShowSceneMode.cpp')
 ];
 
+const bench_sound_names = [
+	maek.CPP('bench-sound.cpp')
+];
+
+const render_sound_names = [
+	maek.CPP('render-sound.cpp')
+];
+
+const replay_sound_names = [
+	maek.CPP('replay-sound.cpp')
+];
+
 //the '[exeFile =] LINK(objFiles, exeFileBase, [, options])' links an array of objects into an executable:
 // objFiles: array of objects to link
 // exeFileBase: name of executable file to produce
 //returns exeFile: exeFileBase + a platform-dependant suffix (e.g., '.exe' on windows)
-const game_exe = maek.LINK([...game_names, ...common_names], 'dist/game');
+const game_exe = maek.LINK([...game_names, ...sound_names, ...common_names], 'dist/game');
 const show_meshes_exe = maek.LINK([...show_meshes_names, ...common_names], 'scenes/show-meshes');
 const show_scene_exe = maek.LINK([...show_scene_names, ...common_names], 'scenes/show-scene');
+//mixer benchmarks (not built by default; build with 'node Maekfile.js bench-sound'):
+const bench_sound_exe = maek.LINK([...bench_sound_names, ...sound_names], 'bench-sound');
+//offline renderer for scripted sound events (not built by default; build with 'node Maekfile.js render-sound'):
+const render_sound_exe = maek.LINK([...render_sound_names, ...sound_names], 'render-sound');
+//replays sound captures (see Sound::Settings::capture_file) offline (not built by default; build with 'node Maekfile.js replay-sound'):
+const replay_sound_exe = maek.LINK([...replay_sound_names, ...sound_names], 'replay-sound');
 
 //set the default target to the game (and copy the readme files):
 maek.TARGETS = [game_exe, show_meshes_exe, show_scene_exe, ...copies];
@@ -36,6 +36,25 @@ Load< Scene > level1_scene(LoadTagDefault, []() -> Scene const * {
 	});
 });
 
+//sound effects are decoded in parallel on worker threads (call_load_functions() waits for them):
+Load< Sound::Sample > good_block_sound(LoadTagDefault, []() -> Sound::Sample const * {
+	Sound::Sample *sample = new Sound::Sample();
+	add_load_future(sample->load_async(data_path("good-block.wav")));
+	return sample;
+});
+
+Load< Sound::Sample > bad_block_sound(LoadTagDefault, []() -> Sound::Sample const * {
+	Sound::Sample *sample = new Sound::Sample();
+	add_load_future(sample->load_async(data_path("bad-block.wav")));
+	return sample;
+});
+
+Load< Sound::Sample > oof_got_hit_sound(LoadTagDefault, []() -> Sound::Sample const * {
+	Sound::Sample *sample = new Sound::Sample();
+	add_load_future(sample->load_async(data_path("oof.wav")));
+	return sample;
+});
+
 void PlayMode::GeneratePlatforms(bool is_initial_drawing, Direction new_direction, float vertical_offset) {
 	for (size_t i = 0; i < row_size; i++) {
 		/* Lower row -- draw only if it is the first row or if direction is changing */
@@ -193,8 +212,8 @@ void PlayMode::update(float elapsed) {
 		}
 
 		// play the appropriate sound if the up button is clicked
-		if (up.pressed && !player_moving_horizontally && !player_jumping && (current_sound_effect == nullptr || current_sound_effect->stopped)) {
-			current_sound_effect = Sound::play((blocks_sound_vector[player_block_index] == 1) ? good_block_sound : bad_block_sound);
+		if (up.pressed && !player_moving_horizontally && !player_jumping && current_sound_effect.stopped()) {
+			current_sound_effect = Sound::play((blocks_sound_vector[player_block_index] == 1) ? *good_block_sound : *bad_block_sound);
 		}
 
 		// logic for jumping to next platform
@@ -215,7 +234,7 @@ void PlayMode::update(float elapsed) {
 					current_streak += 1;
 					if (longest_streak < current_streak) longest_streak = current_streak;
 				} else {
-					Sound::play(oof_got_hit_sound);
+					Sound::play(*oof_got_hit_sound);
 					ResetPlayerPosition();
 					current_streak = 0;
 				}
@@ -47,10 +47,7 @@ struct PlayMode : Mode {
 	Direction direction = South;
 
 	//sound effects:
-	Sound::Sample good_block_sound = Sound::Sample(data_path("good-block.wav"));
-	Sound::Sample bad_block_sound = Sound::Sample(data_path("bad-block.wav"));
-	Sound::Sample oof_got_hit_sound = Sound::Sample(data_path("oof.wav"));
-	std::shared_ptr< Sound::PlayingSample > current_sound_effect;
+	Sound::PlayingSample current_sound_effect;
 	
 	//camera:
 	Scene::Camera *camera = nullptr;
@@ -0,0 +1,134 @@
+#include "RealFFT.hpp"
+
+#include <cassert>
+#include <cmath>
+
+using Complex = RealFFT::Complex;
+
+static inline Complex operator+(Complex a, Complex b) { return Complex{a.re + b.re, a.im + b.im}; }
+static inline Complex operator-(Complex a, Complex b) { return Complex{a.re - b.re, a.im - b.im}; }
+static inline Complex operator*(Complex a, Complex b) { return Complex{a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re}; }
+static inline Complex operator*(Complex a, float b) { return Complex{a.re * b, a.im * b}; }
+static inline Complex conj(Complex a) { return Complex{a.re, -a.im}; }
+static inline Complex times_i(Complex a) { return Complex{-a.im, a.re}; }
+
+RealFFT::RealFFT(uint32_t size) {
+	assert(size >= 4 && (size & (size - 1)) == 0 && "RealFFT size is a power of two");
+	uint32_t half = size / 2;
+	double const pi = 3.14159265358979323846;
+
+	twiddles.resize(half);
+	for (uint32_t j = 0; j < half; ++j) {
+		double angle = -2.0 * pi * double(j) / double(half);
+		twiddles[j] = Complex{float(std::cos(angle)), float(std::sin(angle))};
+	}
+	split_twiddles.resize(half + 1);
+	for (uint32_t k = 0; k <= half; ++k) {
+		double angle = -2.0 * pi * double(k) / double(size);
+		split_twiddles[k] = Complex{float(std::cos(angle)), float(std::sin(angle))};
+	}
+
+	uint32_t bits = 0;
+	while ((1U << bits) < half) ++bits;
+	bit_reverse.resize(half);
+	for (uint32_t i = 0; i < half; ++i) {
+		uint32_t r = 0;
+		for (uint32_t b = 0; b < bits; ++b) {
+			if (i & (1U << b)) r |= 1U << (bits - 1 - b);
+		}
+		bit_reverse[i] = r;
+	}
+
+	work.resize(half);
+}
+
+void RealFFT::complex_transform() const {
+	uint32_t count = uint32_t(work.size());
+	Complex *w = work.data();
+
+	//decimation in time: input is in bit-reversed order, so each stage combines neighboring blocks into larger transforms:
+	uint32_t length = 1; //length of the transforms already done
+
+	//(an odd number of doublings needs one radix-2 stage; the rest are radix-4)
+	uint32_t bits = 0;
+	while ((1U << bits) < count) ++bits;
+	if (bits % 2 == 1) {
+		for (uint32_t i = 0; i < count; i += 2) {
+			Complex a = w[i], b = w[i+1];
+			w[i] = a + b;
+			w[i+1] = a - b;
+		}
+		length = 2;
+	}
+
+	for (; length < count; length *= 4) {
+		uint32_t step = count / (4 * length); //(twiddle for e^(-2 pi i k / (4 * length)) is twiddles[k * step])
+		for (uint32_t base = 0; base < count; base += 4 * length) {
+			for (uint32_t k = 0; k < length; ++k) {
+				//(in bit-reversed order, the four blocks hold the transforms of samples 4n, 4n+2, 4n+1, 4n+3)
+				Complex a0 = w[base + k];
+				Complex a2 = w[base + length + k] * twiddles[2 * k * step];
+				Complex a1 = w[base + 2 * length + k] * twiddles[k * step];
+				Complex a3 = w[base + 3 * length + k] * twiddles[3 * k * step];
+
+				Complex s02 = a0 + a2, d02 = a0 - a2;
+				Complex s13 = a1 + a3, d13 = times_i(a1 - a3);
+				w[base + k] = s02 + s13;
+				w[base + length + k] = d02 - d13;
+				w[base + 2 * length + k] = s02 - s13;
+				w[base + 3 * length + k] = d02 + d13;
+			}
+		}
+	}
+}
+
+void RealFFT::forward(float const *in, float *spectrum) const {
+	uint32_t half = uint32_t(work.size());
+
+	//transform even samples as real parts and odd samples as imaginary parts, all at once:
+	for (uint32_t n = 0; n < half; ++n) {
+		work[bit_reverse[n]] = Complex{in[2*n], in[2*n+1]};
+	}
+	complex_transform();
+
+	//...then pull the two transforms apart and combine them into the full spectrum:
+	float *re = spectrum;
+	float *im = spectrum + half + 1;
+	re[0] = work[0].re + work[0].im;
+	im[0] = 0.0f;
+	re[half] = work[0].re - work[0].im;
+	im[half] = 0.0f;
+	for (uint32_t k = 1; k < half; ++k) {
+		Complex z = work[k];
+		Complex zc = conj(work[half - k]);
+		Complex even = (z + zc) * 0.5f;
+		Complex diff = z - zc;
+		Complex odd = Complex{0.5f * diff.im, -0.5f * diff.re}; //(z - zc) / 2i
+		Complex x = even + split_twiddles[k] * odd;
+		re[k] = x.re;
+		im[k] = x.im;
+	}
+}
+
+void RealFFT::inverse(float const *spectrum, float *out) const {
+	uint32_t half = uint32_t(work.size());
+	float const *re = spectrum;
+	float const *im = spectrum + half + 1;
+
+	//undo the combining step of forward(), packing the even and odd samples' transforms back into one:
+	// (stored conjugated, so the forward transform below computes the inverse transform, conjugated)
+	for (uint32_t k = 0; k < half; ++k) {
+		Complex x = Complex{re[k], im[k]};
+		Complex xc = Complex{re[half - k], -im[half - k]};
+		Complex even = (x + xc) * 0.5f;
+		Complex odd = (x - xc) * conj(split_twiddles[k]) * 0.5f;
+		work[bit_reverse[k]] = conj(even + times_i(odd));
+	}
+	complex_transform();
+
+	float scale = 1.0f / float(half);
+	for (uint32_t n = 0; n < half; ++n) {
+		out[2*n] = work[n].re * scale;
+		out[2*n+1] = -work[n].im * scale;
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+/*
+ * RealFFT computes discrete Fourier transforms of real-valued signals whose length is a power of two.
+ *
+ * It is used by ConvolutionReverb (and could be used by other effects) so there's no need for an FFT library:
+ *
+ * RealFFT fft(2048);
+ * std::vector< float > spectrum(fft.spectrum_floats());
+ * fft.forward(signal, spectrum.data()); //2048 samples -> 1025 frequency bins
+ * fft.inverse(spectrum.data(), signal); //...and back again
+ *
+ * Spectra are stored "split": the real parts of bins 0 .. size/2, then the imaginary parts of the same bins.
+ * (this keeps the math on spectra -- e.g., multiplying two of them -- simple to vectorize)
+ *
+ * Internally, a size-N real transform is a size-N/2 complex transform (radix-4 stages, plus one radix-2
+ * stage when needed) followed by a pass that separates the even and odd samples' spectra.
+ *
+ * forward() and inverse() don't allocate, so they may be used on the audio thread.
+ * (they do share scratch space, so don't use one RealFFT from two threads at once)
+ *
+ */
+
+#include <vector>
+#include <cstdint>
+
+struct RealFFT {
+	//set up transforms of 'size' samples (a power of two, at least 4):
+	RealFFT(uint32_t size);
+
+	uint32_t size() const { return uint32_t(twiddles.size()) * 2; }
+	//number of floats in a spectrum (size/2 + 1 real parts, then size/2 + 1 imaginary parts):
+	uint32_t spectrum_floats() const { return size() + 2; }
+
+	//spectrum of 'size' samples from 'in':
+	// (unscaled -- a constant signal of 1.0 has 'size' in bin 0)
+	void forward(float const *in, float *spectrum) const;
+
+	//'size' samples from 'spectrum' (scaled so that inverse(forward(x)) is x):
+	void inverse(float const *spectrum, float *out) const;
+
+	//internals:
+	struct Complex {
+		float re, im;
+	};
+	std::vector< Complex > twiddles; //e^(-2 pi i j / (size/2)) for j in [0, size/2)
+	std::vector< Complex > split_twiddles; //e^(-2 pi i k / size) for k in [0, size/2]
+	std::vector< uint32_t > bit_reverse; //permutation that puts complex transform input in bit-reversed order
+	mutable std::vector< Complex > work; //(size/2 complex values of scratch space)
+
+	//in-place complex transform of 'work' (after permutation), forward (e^-i) direction:
+	void complex_transform() const;
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+/*
+ * SPSCQueue< T > is a fixed-capacity, wait-free, single-producer / single-consumer queue.
+ *
+ * It is used to pass messages between exactly two threads (e.g., the game thread and the audio callback)
+ * without taking a lock. Storage is allocated once (in the constructor or in 'reset()'), so push/pop never allocate.
+ *
+ * //producer thread:
+ * if (!queue.push(message)) { ... queue was full ... }
+ *
+ * //consumer thread:
+ * T message;
+ * while (queue.pop(&message)) { ... }
+ *
+ * There are also bulk versions of push() and pop() for streaming data (e.g., audio samples) through the queue.
+ *
+ */
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <cassert>
+
+template< typename T >
+struct SPSCQueue {
+	//capacity is rounded up to a power of two:
+	SPSCQueue(uint32_t capacity = 0) { reset(capacity); }
+
+	//(re)allocate storage; only call when neither thread is using the queue:
+	void reset(uint32_t capacity) {
+		uint32_t size = 1;
+		while (size < capacity) size *= 2;
+		slots.assign(size, T());
+		mask = size - 1;
+		head.store(0, std::memory_order_relaxed);
+		tail.store(0, std::memory_order_relaxed);
+	}
+
+	uint32_t capacity() const { return uint32_t(slots.size()); }
+
+	//the queue's storage (e.g., for locking it into memory):
+	void const *storage() const { return slots.data(); }
+	size_t storage_bytes() const { return slots.size() * sizeof(T); }
+
+	//producer only -- returns false (and does nothing) if the queue is full:
+	bool push(T const &value) {
+		uint32_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == capacity()) return false;
+		slots[t & mask] = value;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	//consumer only -- returns false if the queue is empty:
+	bool pop(T *value_) {
+		assert(value_);
+		uint32_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire)) return false;
+		*value_ = std::move(slots[h & mask]);
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	//producer only -- push up to 'count' values; returns the number actually pushed:
+	uint32_t push(T const *values, uint32_t count) {
+		uint32_t t = tail.load(std::memory_order_relaxed);
+		uint32_t space = capacity() - (t - head.load(std::memory_order_acquire));
+		if (count > space) count = space;
+		for (uint32_t i = 0; i < count; ++i) {
+			slots[(t + i) & mask] = values[i];
+		}
+		tail.store(t + count, std::memory_order_release);
+		return count;
+	}
+
+	//consumer only -- pop up to 'count' values into 'values' (or just discard them if 'values' is null);
+	// returns the number actually popped:
+	uint32_t pop(T *values, uint32_t count) {
+		uint32_t h = head.load(std::memory_order_relaxed);
+		uint32_t available = tail.load(std::memory_order_acquire) - h;
+		if (count > available) count = available;
+		if (values) {
+			for (uint32_t i = 0; i < count; ++i) {
+				values[i] = std::move(slots[(h + i) & mask]);
+			}
+		}
+		head.store(h + count, std::memory_order_release);
+		return count;
+	}
+
+	//approximate (exact if called from either end while the other is idle):
+	uint32_t size() const {
+		return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+	}
+
+private:
+	std::vector< T > slots;
+	uint32_t mask = 0;
+	//head/tail are free-running counters; kept on separate cache lines so the threads don't fight over them:
+	alignas(64) std::atomic< uint32_t > head{0}; //next slot to pop (written by consumer)
+	alignas(64) std::atomic< uint32_t > tail{0}; //next slot to push (written by producer)
+};
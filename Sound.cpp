@@ -1,30 +1,423 @@
 #include "Sound.hpp"
 #include "load_wav.hpp"
 #include "load_opus.hpp"
+#include "SPSCQueue.hpp"
+#include "ima_adpcm.hpp"
+#include "WorkerPool.hpp"
+#include "pcm_cache.hpp"
+#include "pcm.hpp"
+#include "sound_capture.hpp"
 
 #include <SDL.h>
+#include <opusfile.h>
 
-#include <list>
 #include <cassert>
 #include <exception>
 #include <iostream>
+#include <fstream>
 #include <algorithm>
+#include <array>
+#include <thread>
+#include <chrono>
+#include <filesystem>
+#include <cstdio>
+#include <cstdlib>
+
+//(for pinning threads to cores, real-time priority, and locking memory -- see Settings::realtime)
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <climits>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <mach/thread_policy.h>
+#include <mach/semaphore.h>
+#else
+#include <semaphore.h>
+#include <cerrno>
+#endif
+#endif
+
+//SIMD mixing kernels are selected at compile time (AVX when built with -mavx2 or /arch:AVX2; SSE on any x86-64):
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SOUND_MIX_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SOUND_MIX_SSE
+#endif
 
 //local (to this file) data used by the audio system:
 namespace {
 
 	//handy constants:
 	constexpr uint32_t const AUDIO_RATE = 48000; //sampling rate
-	constexpr uint32_t const MIX_SAMPLES = 1024; //number of samples to mix per call of mix_audio callback; n.b. SDL requires this to be a power of two
+	constexpr uint32_t const MIN_MIX_SAMPLES = 128; //smallest block size (see Settings::block_size)
+	constexpr uint32_t const MAX_MIX_SAMPLES = 1024; //largest block size (buffers are allocated this big)
+
+	//number of samples to mix per call of mix_audio callback; n.b. SDL requires this to be a power of two
+	// (only changed while the audio device is closed):
+	uint32_t mix_samples = MAX_MIX_SAMPLES;
+	float ramp_step = float(MAX_MIX_SAMPLES) / float(AUDIO_RATE); //duration of a block, in seconds (ramps advance this much per block)
 
 	//The audio device:
 	SDL_AudioDeviceID device = 0;
 
-	//list of all currently playing samples:
-	std::list< std::shared_ptr< Sound::PlayingSample > > playing_samples;
+	//stereo output samples / stereo gains:
+	struct LR {
+		float l;
+		float r;
+	};
+	static_assert(sizeof(LR) == 8, "Sample is packed");
+
+	//Voice holds the state of a sample that is playing:
+	struct Voice {
+		Sound::Sample const *sample = nullptr; //sample being played...
+		Sound::Stream::Decoder *stream = nullptr; //...or stream being played
+		uint32_t i = 0; //next data value to read (for samples)
+		float frac = 0.0f; //fractional part of the playhead, between 'i' and 'i + 1' (for samples played at rates other than 1.0)
+		bool loop = false; //should playback loop after data runs out?
+		bool stopping = false; //is playback stopping?
+		uint64_t start = 0; //audio clock time (in samples) that playback starts at (see Sound::play_at(); 0 means right away)
+
+		//voice limiting:
+		int32_t priority = 0; //higher priority voices are chosen to be mixed first
+		bool real = false; //is this voice being mixed this block? (otherwise it is "virtual": it advances silently)
+		bool was_real = false; //was this voice mixed last block?
+		bool fresh = true; //has this voice not been through a block yet?
+
+		//far voices (see Settings::far_radii and "Far voices", below):
+		bool far = false; //set aside in the spatial hash (so not in active_voices)?
+		bool leaving = false; //too far away to hear, so fading out before being set aside
+		float rate = 1.0f; //playback rate while far (the live, ramping value is kept in 'params' otherwise)
+		uint64_t far_since = 0; //audio clock time the playhead was last brought up to date while far
+		uint32_t far_index = -1U; //index in far_voices while far
+		uint32_t far_bucket = -1U; //bucket in far_cells while far
+		uint32_t far_next = -1U, far_prev = -1U; //slots of neighbors in the bucket's list
+		uint32_t far_serial = 0; //bumped whenever this voice's far_ends entry goes stale
+
+		uint32_t active_index = -1U; //index in active_voices (and params, below) while playing
+		uint32_t bus = 0; //index (in 'buses', below) of the bus this voice is mixed into
+		uint32_t capture_source = -1U; //id of the sample or stream in the capture (see Settings::capture_file)
+
+		//starting parameters (copied into 'params' when the voice starts; the live, ramping values are kept there):
+		float volume = 1.0f;
+
+		//2D playback panning control: ('NaN' if sound played in 3D mode)
+		float pan = std::numeric_limits< float >::quiet_NaN();
+
+		//3D playback panning control: ('NaN' if sound played in 2D mode)
+		glm::vec3 position = glm::vec3(std::numeric_limits< float >::quiet_NaN());
+		float half_volume_radius = std::numeric_limits< float >::quiet_NaN();
+	};
+
+	//The voice pool (allocated once, by Sound::init()):
+	// a slot belongs to the game thread while it is free, and to the audio thread from its Play command until it finishes.
+	std::vector< Voice > voices;
+
+	//per-slot generation counts; the audio thread bumps these when a voice finishes, which makes old handles stale:
+	std::unique_ptr< std::atomic< uint32_t >[] > generations;
+
+	//slots of voices that are currently playing (audio thread only; capacity is reserved up front):
+	std::vector< uint32_t > active_voices;
+
+	//values for many voices that ramp like Sound::Ramp< float >, stored as parallel arrays
+	// (so they can be stepped a few at a time with SIMD):
+	struct RampArray {
+		std::vector< float > value;
+		std::vector< float > target;
+		std::vector< float > ramp;
+	};
+
+	//per-voice mixing parameters, as a structure of arrays indexed in parallel with active_voices (audio thread only):
+	struct VoiceParams {
+		RampArray volume;
+		RampArray pan; //NaN for 3D voices
+		RampArray x, y, z; //position; NaN for 2D voices
+		RampArray half_volume_radius; //NaN for 2D voices
+		RampArray rate; //playback rate (always 1.0 for streams)
+
+		//rate at the start of the block (the rate ramps linearly to 'rate.value' over the block):
+		std::vector< float > start_rate;
+
+		//1.0 for voices on ambisonic buses, 0.0 for the rest (set when the voice starts, or changes bus):
+		std::vector< float > ambisonic;
+
+		//computed every block by compute_voice_gains():
+		std::vector< float > audibility; //how loud the voice is at the start of the block (used to choose real voices)
+		std::vector< float > start_l, start_r; //left/right gains at the start of the block
+		std::vector< float > end_l, end_r; //left/right gains at the end of the block
+		//voices on ambisonic buses use the left/right gains above for W and X, and these for Y and Z:
+		std::vector< float > start_y_gain, start_z_gain;
+		std::vector< float > end_y_gain, end_z_gain;
+
+		//the per-block arrays above (not ramps):
+		std::array< std::vector< float > *, 10 > block_arrays() {
+			return {&start_rate, &audibility, &start_l, &start_r, &end_l, &end_r, &start_y_gain, &start_z_gain, &end_y_gain, &end_z_gain};
+		}
+
+		//call 'f' on every array:
+		template< typename F >
+		void for_each_array(F const &f) {
+			for (RampArray *r : {&volume, &pan, &x, &y, &z, &half_volume_radius, &rate}) {
+				f(r->value);
+				f(r->target);
+				f(r->ramp);
+			}
+			f(ambisonic);
+			for (std::vector< float > *a : block_arrays()) {
+				f(*a);
+			}
+		}
+	} params;
+
+	//submix buses (set up by Sound::init(); see Settings::buses):
+	struct BusState {
+		std::string name;
+		uint32_t parent = -1U; //index of the bus this one mixes into (-1U for master)
+		Sound::Ramp< float > volume = Sound::Ramp< float >(1.0f);
+		std::vector< Sound::Effect * > effects; //run in order each block (only changed with the audio thread locked out)
+		std::vector< LR > buffer; //MAX_MIX_SAMPLES frames of storage (not used by master, which mixes straight into the output)
+		LR *mix = nullptr; //where this block's audio for the bus is mixed
+		//ambisonic buses (see Settings::ambisonic_buses) store B-format audio as two runs of MAX_MIX_SAMPLES frames -- (W, X) then (Y, Z) --
+		// and are decoded to stereo (in the first run) before their effects are run:
+		bool ambisonic = false;
+		float audibility = 1.0f; //loudest gain from this bus to the output this block (used to choose real voices)
+	};
+	//in topological order -- every bus comes before its parent, so master is last (audio thread only, after init):
+	std::vector< BusState > buses;
+
+	//is any bus ambisonic? (if not, compute_voice_gains() can skip B-format encoding):
+	bool any_ambisonic = false;
+
+	//buses that newly-played samples and streams are mixed into:
+	uint32_t default_sample_bus = 0;
+	uint32_t default_stream_bus = 0;
+
+	//slots that are free to be played (pushed by the audio thread, popped by the game thread):
+	SPSCQueue< uint32_t > free_voices;
+
+	//Far voices -- 3D voices too far from the listener to hear (see Settings::far_radii) -- are taken out of active_voices,
+	// so the mixer skips them entirely. Their ramps are snapped to their targets, and their playheads are brought up to date
+	// all at once when they come back into range (or change rate). They are kept in a spatial hash, in cells at least as
+	// big as any far voice's range, so the 27 cells around the listener hold every far voice that might be back in range.
+	float far_radii = 0.0f; //(0 means voices are never far)
+	std::vector< uint32_t > far_voices; //slots of far voices (audio thread only; capacity is reserved up front)
+	std::vector< uint32_t > far_cells; //spatial hash buckets: first far voice in each (-1U if none), linked through Voice::far_next
+	float far_cell_size = 0.0f; //size of the spatial hash's cells
+	//far one-shot voices end on their own; when each will end is kept in a min-heap:
+	struct FarEnd {
+		uint64_t end; //audio clock time the voice ends
+		uint32_t slot;
+		uint32_t serial; //(if this doesn't match the voice's far_serial, the entry is stale)
+	};
+	std::vector< FarEnd > far_ends;
+	//far voices come back a bit inside their range (so voices right at the edge don't flip back and forth):
+	constexpr float const FAR_RETURN = 0.9f;
+
+	//number of voices that may be mixed in each block:
+	uint32_t max_real_voices = 0;
+
+	//scratch space for choosing real voices (audio thread only; capacity is reserved up front):
+	struct VoiceRank {
+		int32_t priority;
+		float audibility;
+		uint32_t active_index;
+	};
+	std::vector< VoiceRank > voice_ranks;
+
+	//set when running without an audio device (Sound::render() drives the mixer, so streams must never underrun):
+	bool offline = false;
+
+	//offline rendering mixes a block at a time into this buffer:
+	std::vector< LR > render_buffer;
+	uint32_t render_buffer_frames = 0; //frames mixed into render_buffer
+	uint32_t render_buffer_used = 0; //frames of render_buffer already returned by Sound::render()
+
+	//number of voices mixed in the last block:
+	uint32_t voices_mixed_last_block = 0;
+
+	//mixer measurements, passed from the audio thread to Sound::stats():
+	constexpr uint32_t const STATS_HISTORY = 512; //(about ten seconds of blocks)
+	SPSCQueue< Sound::BlockStats > block_stats(STATS_HISTORY);
+	uint64_t blocks_mixed = 0; //(audio thread only)
+	//running totals (written by the audio thread):
+	std::atomic< uint64_t > stats_blocks{0};
+	std::atomic< uint64_t > stats_missed_deadlines{0};
+	std::atomic< uint64_t > stats_dropped{0};
+	//what Sound::stats() has collected so far (game thread only):
+	Sound::Stats collected_stats;
+
+	//fastest allowed playback rate (see PlayingSample::set_rate):
+	constexpr float const MAX_RATE = 4.0f;
+
+	//voices are mixed in 'chunks' (active voices c, c + chunks, c + 2 * chunks, ...), one per mixing thread (see Settings::mix_threads):
+	struct MixChunk {
+		//chunk 0 mixes straight into the buses; the others mix into their own copy of every bus,
+		// which are then added to the buses in chunk order (so the result doesn't depend on which thread mixed what):
+		std::vector< LR > buffer; //buses.size() * 2 * MAX_MIX_SAMPLES frames (empty for chunk 0; 2x for ambisonic buses)
+		LR *bus_mix(uint32_t bus) { //where to mix voices playing through 'bus'
+			return (buffer.empty() ? buses[bus].mix : buffer.data() + size_t(bus) * 2 * MAX_MIX_SAMPLES);
+		}
+
+		//streams and compressed samples are decoded into this before being mixed:
+		std::vector< float > decode_buffer;
+		//samples played at rates other than 1.0 are gathered here, then resampled into decode_buffer:
+		std::vector< float > rate_buffer;
+
+		uint32_t voices_mixed = 0; //(this block)
+	};
+	std::vector< MixChunk > mix_chunks;
+
+	//set for each active voice that finished during the block (voices are returned to the pool once all chunks are mixed):
+	std::vector< uint8_t > voice_finished;
+
+	//a counting semaphore from the OS (posting one never blocks or takes a lock, so the audio thread can wake workers in strict real-time mode):
+	struct WakeSemaphore {
+		WakeSemaphore();
+		~WakeSemaphore();
+		WakeSemaphore(WakeSemaphore const &) = delete;
+		WakeSemaphore &operator=(WakeSemaphore const &) = delete;
+		void post(); //wake the waiting thread (or let its next wait() return right away)
+		void wait();
+	#if defined(_WIN32)
+		HANDLE handle;
+	#elif defined(__APPLE__)
+		semaphore_t semaphore;
+	#else
+		sem_t semaphore;
+	#endif
+	};
+
+	//mixer worker threads (mix_chunks.size() - 1 of them; the audio thread mixes too):
+	std::vector< std::thread > mix_workers;
+	std::vector< std::unique_ptr< WakeSemaphore > > mix_workers_wake; //(one per worker; posted to start a block, or to quit)
+	std::atomic< bool > mix_workers_quit{false};
+	std::atomic< uint32_t > next_chunk{-1U}; //next chunk to claim (>= mix_chunks.size() when there is nothing to do)
+	std::atomic< uint32_t > chunks_done{0}; //chunks finished this block
+	//(with fewer voices than this, waking the workers costs more than it saves, so the audio thread mixes every chunk itself)
+	constexpr uint32_t const WORKER_MIN_VOICES = 32;
+	//(times the audio thread checks for a worker to finish its chunk before yielding the core -- a few tens of microseconds)
+	constexpr uint32_t const WORKER_SPINS = 4096;
+
+	//voices quieter than this are always virtual (about -80dB):
+	constexpr float const INAUDIBLE = 1e-4f;
+
+	//commands sent from the game thread to the audio thread:
+	struct Command {
+		enum Type : uint8_t {
+			Play, //start playing voice 'slot'
+			SetVolume, //set voice's volume to 'value' over 'ramp'
+			SetPan, //set voice's pan to 'value' over 'ramp'
+			SetPosition, //set voice's position to 'a' over 'ramp'
+			SetHalfVolumeRadius, //set voice's half volume radius to 'value' over 'ramp'
+			SetRate, //set voice's playback rate to 'value' over 'ramp'
+			SetPriority, //set voice's priority to 'int_value'
+			SetBus, //mix voice into bus 'int_value'
+			Stop, //stop voice over 'ramp'
+			StopAll, //stop all playing voices
+			SetListener, //set listener position to 'a' and right to 'b' over 'ramp'
+			SetGlobalVolume, //set Sound::volume to 'value' over 'ramp'
+			SetBusVolume, //set volume of bus 'int_value' to 'value' over 'ramp'
+			SetBusEffects, //swap the effects of bus 'int_value' with '*effects' (and hand 'effects' back through retired_effects)
+		} type = Play;
+		uint32_t slot = -1U; //voice the command applies to (if any)...
+		uint32_t generation = 0; //...and that voice's generation (commands for stale handles are ignored)
+		int32_t int_value = 0;
+		glm::vec3 a = glm::vec3(0.0f);
+		glm::vec3 b = glm::vec3(0.0f);
+		float value = 0.0f;
+		float ramp = 0.0f;
+		std::vector< Sound::Effect * > *effects = nullptr;
+	};
+
+	//drained by mix_audio at the start of every block:
+	SPSCQueue< Command > commands(4096);
+
+	//the audio clock (see Sound::audio_clock()) -- samples mixed before the block being mixed (audio thread only)...
+	uint64_t block_clock = 0;
+	//...and as seen by the game thread (published at the end of every block):
+	std::atomic< uint64_t > audio_clock_samples{0};
+
+	//strict real-time mode (see Settings::realtime):
+	// (the audio thread takes no locks while mixing -- mixer workers are woken with semaphores -- and doesn't allocate)
+	bool realtime = false;
+	uint32_t audio_thread_core = -1U; //(see Settings::audio_thread_core)
+	bool audio_thread_configured = false; //set by the audio thread once it has asked for priority/affinity (reset when the device is opened)
+	std::vector< std::pair< void const *, size_t > > locked_buffers; //buffers locked into memory by Sound::init()
+
+	//effect lists replaced by Bus::set_effects() are handed back to the game thread to be freed (so the audio thread never frees memory):
+	SPSCQueue< std::vector< Sound::Effect * > * > retired_effects;
+
+	//Debug option: build with SOUND_TRAP_AUDIO_ALLOCATIONS defined (e.g., add '-DSOUND_TRAP_AUDIO_ALLOCATIONS' to CPPFlags in Maekfile.js)
+	// to abort whenever the audio thread (or a mixer worker) allocates or frees memory while mixing -- e.g., in an Effect.
+	// (this replaces the global operator new and delete -- see the end of this file -- so C++ allocations are caught, but not direct calls to malloc)
+#ifdef SOUND_TRAP_AUDIO_ALLOCATIONS
+	thread_local bool in_mixer = false;
+	struct NoAllocations {
+		NoAllocations() { in_mixer = true; }
+		~NoAllocations() { in_mixer = false; }
+	};
+#else
+	struct NoAllocations {
+		NoAllocations() { }
+	};
+#endif
+
+	//number of samples played so far, used to stamp Sample::last_played (game thread only):
+	uint64_t play_count = 0;
+
+	//command capture (see Settings::capture_file and sound_capture.hpp):
+	// apply_command() records each command into 'captured' (stamped with the block it takes effect in),
+	// and the game thread writes them out whenever it sends a command (and at shutdown):
+	bool capturing = false; //(set by Sound::init())
+	SPSCQueue< CaptureCommand > captured;
+	std::atomic< bool > capture_dropped{false}; //set if 'captured' was ever full (shouldn't happen -- see Sound::init())
+	std::unique_ptr< CaptureWriter > capture; //(game thread only)
+	//samples and streams already written to the capture, by address (game thread only):
+	struct CaptureSource {
+		uint32_t id;
+		void const *data; //sample data when written (if this changes, another sample is at the same address)
+	};
+	std::map< void const *, CaptureSource > capture_sources;
+	uint32_t capture_source_count = 0;
+	//samples that were still loading when played (written to the capture once they have loaded):
+	std::vector< std::pair< uint32_t, Sound::Sample const * > > capture_loading;
 
 }
 
+//This audio-mixing callback is defined below:
+void mix_audio(void *, Uint8 *buffer_, int len);
+//Device and block size handling are defined below:
+void open_device();
+void set_mix_samples(uint32_t block_size);
+//Mixer workers are also defined below:
+void start_mix_workers();
+void stop_mix_workers();
+//Voice and command handling are also defined below:
+void remove_active_voice(uint32_t active_index);
+void advance_playhead(Voice &voice, double advance);
+Sound::PlayingSample start_voice(Voice const &voice);
+void push_command(Command const &command);
+void drain_commands();
+void free_retired_effects();
+//Command capture is also defined below:
+uint32_t capture_source(Voice const &voice);
+void capture_block_size();
+void flush_capture();
+void close_capture();
+//Real-time support is also defined below:
+void lock_buffers();
+void unlock_buffers();
+void request_realtime_priority();
+void pin_thread(uint32_t core);
+
 //public-facing data:
 
 //global volume control:
@@ -33,42 +426,924 @@ Sound::Ramp< float > Sound::volume = Sound::Ramp< float >(1.0f);
 //global listener information:
 Sound::Listener Sound::listener;
 
-//This audio-mixing callback is defined below:
-void mix_audio(void *, Uint8 *buffer_, int len);
-
 //------------------------ public-facing --------------------------------
 
-Sound::Sample::Sample(std::string const &filename) {
+Sound::Sample::Sample(std::string const &filename, Format format_) {
+	load(filename, format_);
+}
+
+Sound::Sample::Sample(std::vector< float > const &data_, Format format_) : data(data_) {
+	compress(format_);
+}
+
+Sound::Sample::Sample(Sample const &other) {
+	*this = other;
+}
+
+Sound::Sample &Sound::Sample::operator=(Sample const &other) {
+	assert(!loading && !other.loading && "Samples can't be copied while loading");
+	format = other.format;
+	data = other.data;
+	data16 = other.data16;
+	adpcm = other.adpcm;
+	mapped = other.mapped;
+	length = other.length;
+	return *this;
+}
+
+std::shared_future< void > Sound::Sample::load_async(std::string const &filename, Format format_) {
+	assert(!loading && "Sample is already loading");
+	//voices playing this sample don't look at its data until 'loading' is cleared (see mix_audio()):
+	loading.store(true, std::memory_order_relaxed);
+	return WorkerPool::shared().run([this, filename, format_](){
+		try {
+			load(filename, format_);
+		} catch (...) {
+			//leave the sample empty (so voices playing it just end), then pass the error on through the future:
+			format = Float32;
+			data.clear();
+			data16.clear();
+			adpcm.clear();
+			mapped.reset();
+			length = 0;
+			loading.store(false, std::memory_order_release);
+			throw;
+		}
+		loading.store(false, std::memory_order_release); //(publishes the sample data to the audio thread)
+	});
+}
+
+void Sound::Sample::load(std::string const &filename, Format format_) {
 	if (filename.size() >= 4 && filename.substr(filename.size()-4) == ".wav") {
 		load_wav(filename, &data);
 	} else if (filename.size() >= 5 && filename.substr(filename.size()-5) == ".opus") {
-		load_opus(filename, &data);
+		//opus files are slow to decode, so decoded audio may be cached (see Settings::pcm_cache_directory):
+		if (load_pcm_cache(filename, &mapped, &length)) {
+			if (format_ == Float32) {
+				//play straight from the mapped file:
+				format = Float32;
+				std::vector< float >().swap(data);
+				return;
+			}
+			data.assign(mapped.get(), mapped.get() + length);
+			mapped.reset();
+		} else {
+			load_opus(filename, &data);
+			save_pcm_cache(filename, data);
+		}
 	} else {
 		throw std::runtime_error("Sample '" + filename + "' doesn't end in either \".png\" or \".opus\" -- unsure how to load.");
 	}
+	compress(format_);
+}
+
+void Sound::Sample::compress(Format format_) {
+	format = format_;
+	length = uint32_t(data.size());
+	if (format == Int16) {
+		data16.resize(data.size());
+		pcm_to_s16(data.data(), length, data16.data());
+		std::vector< float >().swap(data); //release float storage
+	} else if (format == ADPCM) {
+		adpcm_encode(data.data(), length, &adpcm);
+		std::vector< float >().swap(data); //release float storage
+	} else {
+		assert(format == Float32);
+	}
 }
 
-Sound::Sample::Sample(std::vector< float > const &data_) : data(data_) {
+size_t Sound::Sample::resident_bytes() const {
+	//(mapped samples are counted too, since they take up memory once they have been played)
+	size_t mapped_bytes = (mapped ? length * sizeof(float) : 0);
+	return data.size() * sizeof(float) + data16.size() * sizeof(int16_t) + adpcm.size() + mapped_bytes;
 }
 
+void Sound::Sample::decode(uint32_t begin, uint32_t count, float *out) const {
+	assert(begin + count <= length);
+	if (format == Float32) {
+		std::copy(floats() + begin, floats() + begin + count, out);
+	} else if (format == Int16) {
+		//(scaled to match compress(), which stores samples * 32767)
+		pcm_from_s16(data16.data() + begin, count, out, 1.0f / 32767.0f);
+	} else {
+		adpcm_decode(adpcm, begin, count, out);
+	}
+}
+
+//------------------------ sample cache --------------------------------
+
+Sound::SampleCache::SampleCache(size_t budget_) : budget(budget_) {
+}
+
+Sound::SampleCache::Handle Sound::SampleCache::get(std::string const &filename, Sample::Format format) {
+	//look files up by canonical path (falling back to the name as given if the file can't be found -- loading will fail below):
+	std::error_code error;
+	std::filesystem::path canonical = std::filesystem::absolute(filename, error);
+	if (!error) canonical = std::filesystem::weakly_canonical(canonical, error);
+	std::string path = (error ? filename : canonical.string());
+
+	auto key = std::make_pair(path, format);
+	auto f = entries.find(key);
+	if (f == entries.end() || !f->second.sample) {
+		std::shared_ptr< Sample > sample = std::make_shared< Sample >(path, format); //(throws on error)
+		f = entries.emplace(key, Entry()).first; //(finds the old entry if the sample was freed)
+		f->second.sample = sample;
+	}
+	f->second.last_used = ++play_count;
+	Handle handle = f->second.sample;
+
+	trim();
+
+	return handle;
+}
+
+void Sound::SampleCache::trim() {
+	size_t used = resident_bytes();
+	if (used <= budget) {
+		warned = false;
+		return;
+	}
+
+	//samples that can be freed -- no handles, not playing -- least-recently-played first:
+	std::vector< std::pair< uint64_t, Entry * > > unused;
+	for (auto &[key, entry] : entries) {
+		if (!entry.sample || entry.sample.use_count() > 1) continue;
+		if (entry.sample->voices.load(std::memory_order_acquire) != 0) continue;
+		unused.emplace_back(std::max(entry.last_used, entry.sample->last_played), &entry);
+	}
+	std::sort(unused.begin(), unused.end(), [](auto const &a, auto const &b) {
+		return a.first < b.first;
+	});
+
+	for (auto const &[stamp, entry] : unused) {
+		if (used <= budget) break;
+		used -= entry->sample->resident_bytes();
+		entry->sample.reset();
+	}
+
+	if (used > budget && !warned) {
+		std::cerr << "WARNING: samples in use take " << used << " bytes, which is over the SampleCache budget of " << budget << " bytes." << std::endl;
+		warned = true;
+	}
+}
+
+void Sound::SampleCache::set_budget(size_t budget_) {
+	budget = budget_;
+	trim();
+}
+
+size_t Sound::SampleCache::resident_bytes() const {
+	size_t total = 0;
+	for (auto const &[key, entry] : entries) {
+		if (entry.sample) total += entry.sample->resident_bytes();
+	}
+	return total;
+}
+
+std::vector< Sound::SampleCache::Usage > Sound::SampleCache::usage() const {
+	std::vector< Usage > ret;
+	ret.reserve(entries.size());
+	for (auto const &[key, entry] : entries) {
+		Usage usage;
+		usage.filename = key.first;
+		usage.format = key.second;
+		usage.resident_bytes = (entry.sample ? entry.sample->resident_bytes() : 0);
+		usage.handles = (entry.sample ? uint32_t(entry.sample.use_count() - 1) : 0);
+		usage.voices = (entry.sample ? entry.sample->voices.load(std::memory_order_relaxed) : 0);
+		ret.emplace_back(usage);
+	}
+	return ret;
+}
+
+//------------------------ streams --------------------------------
+
+struct Sound::Stream::Decoder {
+	Decoder(std::string const &filename);
+	~Decoder();
+
+	//decoding loop (runs in 'thread'):
+	void run();
+
+	//audio thread: read up to 'count' samples into 'out' (or skip them if 'out' is null);
+	// returns the number of samples read, which is less than 'count' at the end of the stream or if decoding fell behind:
+	uint32_t read(float *out, uint32_t count);
+
+	//audio thread: has playback reached the end of a non-looping stream?
+	// (stays true -- the decoder doesn't rewind on its own -- until the next seek, so the voice playing it always sees its end)
+	bool at_end() const;
 
+	//game thread: if the stream has reached its end, ask the decoder to rewind it (used when playing it again):
+	void rewind_if_ended();
+
+	std::string filename;
+	std::unique_ptr< OggOpusFile, decltype(&op_free) > op;
+
+	SPSCQueue< float > ring; //decoded mono samples (decoder thread -> audio thread)
+
+	static constexpr uint64_t const NoEnd = ~uint64_t(0);
+	std::atomic< bool > quit{false}; //set by destructor to stop decoder thread
+	std::atomic< bool > loop{false}; //should the stream wrap around when it runs out?
+	std::atomic< int64_t > seek_to{-1}; //requested seek position (in samples), or -1 for none (cleared once the seek is done)
+	std::atomic< uint64_t > written{0}; //total samples pushed into ring by decoder
+	std::atomic< uint64_t > consumed{0}; //total samples popped from ring by mixer
+	std::atomic< uint64_t > flush_to{0}; //samples before this were decoded before a seek and should be skipped
+	std::atomic< uint64_t > end_at{NoEnd}; //the stream (as written so far) ends after this many samples
+
+	std::thread thread;
+};
+
+Sound::Stream::Decoder::Decoder(std::string const &filename_) : filename(filename_), op(nullptr, op_free) {
+	if (!(filename.size() >= 5 && filename.substr(filename.size()-5) == ".opus")) {
+		throw std::runtime_error("Stream '" + filename + "' doesn't end in \".opus\" -- unsure how to stream.");
+	}
+	int err = 0;
+	op.reset(op_open_file(filename.c_str(), &err));
+	if (err != 0 || !op) {
+		throw std::runtime_error("opusfile error " + std::to_string(err) + " opening \"" + filename + "\".");
+	}
+
+	ring.reset(1 << 16); //about 1.4 seconds of audio
+
+	thread = std::thread(&Decoder::run, this);
+}
+
+Sound::Stream::Decoder::~Decoder() {
+	quit = true;
+	thread.join();
+}
+
+void Sound::Stream::Decoder::run() {
+	//opus packets are at most 120ms (5760 samples at 48kHz):
+	constexpr uint32_t const MaxChunk = 5760;
+	std::vector< float > pcm(2 * MaxChunk, 0.0f);
+	std::vector< float > mono(MaxChunk, 0.0f);
+
+	uint64_t decoded_since_seek = 0; //used to avoid spinning on empty looping streams
+
+	while (!quit) {
+		//handle seek requests:
+		// (the request is cleared only after end_at and flush_to are reset, so at_end() and read() never see a finished seek's stale end)
+		int64_t target = seek_to.load();
+		if (target >= 0) {
+			op_pcm_seek(op.get(), target);
+			decoded_since_seek = 0;
+			end_at = NoEnd;
+			flush_to = written.load();
+			seek_to.compare_exchange_strong(target, -1); //(unless another seek was requested meanwhile)
+		}
+
+		//at the end of a non-looping stream, wait for a seek (Stream::seek, or playing the stream again):
+		if (end_at != NoEnd) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			continue;
+		}
+
+		//wait for room in the ring:
+		if (ring.capacity() - ring.size() < MaxChunk) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			continue;
+		}
+
+		int ret = op_read_float_stereo(op.get(), pcm.data(), int(pcm.size()));
+		if (ret < 0) {
+			std::cerr << "WARNING: opusfile read error " << ret << " streaming '" << filename << "'; ending stream." << std::endl;
+			ret = 0;
+			decoded_since_seek = 0;
+		}
+		if (ret == 0) {
+			//reached the end of the file:
+			if (loop && decoded_since_seek > 0) {
+				op_pcm_seek(op.get(), 0);
+				decoded_since_seek = 0;
+			} else {
+				end_at = written.load();
+			}
+			continue;
+		}
+
+		pcm_downmix(pcm.data(), 2, size_t(ret), mono.data()); //downmix to mono by averaging
+		uint32_t pushed = ring.push(mono.data(), uint32_t(ret));
+		assert(pushed == uint32_t(ret) && "checked for room above");
+		written += pushed;
+		decoded_since_seek += pushed;
+	}
+}
+
+uint32_t Sound::Stream::Decoder::read(float *out, uint32_t count) {
+	if (offline) {
+		//rendering offline, so wait for the decoder rather than underrun (keeps output deterministic):
+		while (seek_to >= 0
+		    || (end_at == NoEnd && written - std::max(consumed.load(), flush_to.load()) < count)) {
+			std::this_thread::yield();
+		}
+	}
+
+	uint64_t at = consumed.load(std::memory_order_relaxed);
+
+	//skip anything decoded before the most recent seek:
+	uint64_t flush = flush_to.load();
+	if (at < flush) {
+		at += ring.pop(nullptr, uint32_t(std::min< uint64_t >(flush - at, ring.capacity())));
+	}
+
+	//don't read past the end of the stream:
+	uint64_t end = end_at.load();
+	if (end != NoEnd) {
+		count = uint32_t(std::min< uint64_t >(count, end > at ? end - at : 0));
+	}
+
+	uint32_t got = ring.pop(out, count);
+	consumed.store(at + got);
+	return got;
+}
+
+bool Sound::Stream::Decoder::at_end() const {
+	if (seek_to.load() >= 0) return false; //(a pending seek -- e.g., a rewind to play again -- is about to reset the end)
+	uint64_t end = end_at.load();
+	return end != NoEnd && consumed.load() >= end;
+}
+
+void Sound::Stream::Decoder::rewind_if_ended() {
+	if (end_at.load() == NoEnd) return;
+	int64_t none = -1;
+	seek_to.compare_exchange_strong(none, 0); //(a seek already requested wins)
+}
+
+Sound::Stream::Stream(std::string const &filename) : decoder(new Decoder(filename)) {
+}
+
+Sound::Stream::~Stream() {
+}
+
+void Sound::Stream::seek(float time) {
+	decoder->seek_to = std::max< int64_t >(0, int64_t(std::round(double(time) * AUDIO_RATE)));
+}
+
+//------------------------ public-facing (continued) --------------------------------
+
+void Sound::init(Settings const &settings) {
+	set_pcm_cache_directory(settings.pcm_cache_directory);
+	close_capture(); //(in case of a previous init)
+
+	unlock_buffers(); //(in case of a previous init)
+	realtime = settings.realtime;
+	audio_thread_core = settings.audio_thread_core;
+
+	//allocate the voice pool (before the audio device starts, so the audio thread never allocates):
+	voices.assign(settings.max_voices, Voice());
+	generations.reset(new std::atomic< uint32_t >[settings.max_voices]);
+	active_voices.clear();
+	active_voices.reserve(settings.max_voices);
+	voice_ranks.clear();
+	voice_ranks.reserve(settings.max_voices);
+	params.for_each_array([&settings](std::vector< float > &array) {
+		array.clear();
+		array.reserve(settings.max_voices);
+	});
+	max_real_voices = settings.max_real_voices;
+	voice_finished.clear();
+	voice_finished.reserve(settings.max_voices);
+	free_voices.reset(settings.max_voices);
+	far_radii = settings.far_radii;
+	far_voices.clear();
+	far_voices.reserve(settings.max_voices);
+	{
+		uint32_t buckets = 64;
+		while (buckets < settings.max_voices) buckets *= 2;
+		far_cells.assign(buckets, -1U);
+	}
+	far_cell_size = 0.0f;
+	far_ends.clear();
+	far_ends.reserve(2 * settings.max_voices);
+	free_retired_effects();
+	retired_effects.reset(commands.capacity() + 1); //(room for every SetBusEffects command that could be queued, plus one being applied)
+	for (uint32_t slot = 0; slot < settings.max_voices; ++slot) {
+		generations[slot].store(0, std::memory_order_relaxed);
+		free_voices.push(slot);
+	}
+
+	//set up buses, sorted so that every bus comes before its parent:
+	{
+		//find each bus's depth (number of buses between it and master):
+		std::vector< std::pair< uint32_t, uint32_t > > depth_index; //(depth, index in settings.buses)
+		for (uint32_t b = 0; b < settings.buses.size(); ++b) {
+			std::string const &name = settings.buses[b].first;
+			if (name == "master") throw std::runtime_error("Bus 'master' is always present; don't list it in Settings::buses.");
+			for (uint32_t o = 0; o < b; ++o) {
+				if (settings.buses[o].first == name) throw std::runtime_error("Bus '" + name + "' is listed twice.");
+			}
+			uint32_t depth = 0;
+			std::string at = settings.buses[b].second;
+			while (at != "master") {
+				auto f = std::find_if(settings.buses.begin(), settings.buses.end(), [&at](auto const &bus) { return bus.first == at; });
+				if (f == settings.buses.end()) throw std::runtime_error("Bus '" + name + "' mixes into '" + at + "', which doesn't exist.");
+				at = f->second;
+				depth += 1;
+				if (depth > settings.buses.size()) throw std::runtime_error("Bus '" + name + "' mixes into itself.");
+			}
+			depth_index.emplace_back(depth, b);
+		}
+		//deepest buses first (ties in the order given):
+		std::stable_sort(depth_index.begin(), depth_index.end(), [](auto const &a, auto const &b) {
+			return a.first > b.first;
+		});
+
+		buses.clear();
+		for (auto const &di : depth_index) {
+			buses.emplace_back();
+			buses.back().name = settings.buses[di.second].first;
+		}
+		buses.emplace_back();
+		buses.back().name = "master";
+
+		for (uint32_t b = 0; b + 1 < buses.size(); ++b) {
+			std::string const &parent = settings.buses[depth_index[b].second].second;
+			for (uint32_t p = b + 1; p < buses.size(); ++p) {
+				if (buses[p].name == parent) buses[b].parent = p;
+			}
+			assert(buses[b].parent != -1U && "parents come after children");
+		}
+
+		//ambisonic buses need room for four channels, and can only have samples mixed into them:
+		any_ambisonic = false;
+		for (std::string const &name : settings.ambisonic_buses) {
+			if (name == "master") throw std::runtime_error("Bus 'master' can't be ambisonic.");
+			auto f = std::find_if(buses.begin(), buses.end(), [&name](BusState const &bus) { return bus.name == name; });
+			if (f == buses.end()) throw std::runtime_error("Ambisonic bus '" + name + "' isn't listed in Settings::buses.");
+			f->ambisonic = true;
+			any_ambisonic = true;
+		}
+		for (uint32_t b = 0; b + 1 < buses.size(); ++b) {
+			if (buses[buses[b].parent].ambisonic) throw std::runtime_error("Bus '" + buses[b].name + "' mixes into ambisonic bus '" + buses[buses[b].parent].name + "'; only samples can play through ambisonic buses.");
+			buses[b].buffer.assign((buses[b].ambisonic ? 2 : 1) * MAX_MIX_SAMPLES, LR{0.0f, 0.0f});
+		}
+		for (auto &bus : buses) {
+			bus.effects.reserve(8);
+		}
+
+		auto find_bus = [](std::string const &name) {
+			for (uint32_t b = 0; b < buses.size(); ++b) {
+				if (buses[b].name == name) return b;
+			}
+			return uint32_t(buses.size() - 1); //(master)
+		};
+		default_sample_bus = find_bus("sfx");
+		default_stream_bus = find_bus("music");
+	}
+
+	//set up voice mixing chunks, and start a worker thread for each chunk past the first (see Settings::mix_threads):
+	stop_mix_workers();
+	{
+		uint32_t threads = settings.mix_threads;
+		if (threads == 0) threads = std::max(1U, std::thread::hardware_concurrency());
+		mix_chunks.assign(threads, MixChunk());
+		for (uint32_t c = 0; c < threads; ++c) {
+			MixChunk &chunk = mix_chunks[c];
+			if (c != 0) chunk.buffer.assign(buses.size() * 2 * MAX_MIX_SAMPLES, LR{0.0f, 0.0f});
+			chunk.decode_buffer.assign(MAX_MIX_SAMPLES, 0.0f);
+			chunk.rate_buffer.assign(uint32_t(MAX_RATE) * MAX_MIX_SAMPLES + 4, 0.0f);
+		}
+		start_mix_workers();
+	}
+
+	//reset the audio clock and stats:
+	block_clock = 0;
+	audio_clock_samples.store(0, std::memory_order_relaxed);
+	block_stats.reset(STATS_HISTORY);
+	blocks_mixed = 0;
+	stats_blocks.store(0, std::memory_order_relaxed);
+	stats_missed_deadlines.store(0, std::memory_order_relaxed);
+	stats_dropped.store(0, std::memory_order_relaxed);
+	collected_stats = Stats();
+
+	set_mix_samples(settings.block_size);
+
+	//start capturing commands (see Settings::capture_file):
+	// ('captured' has room for every command that could be queued plus the one being sent, so can't fill up between flush_capture() calls)
+	captured.reset(settings.capture_file != "" ? commands.capacity() + 2 : 0);
+	capture_dropped.store(false, std::memory_order_relaxed);
+	capture_sources.clear();
+	capture_source_count = 0;
+	capture_loading.clear();
+	if (settings.capture_file != "") {
+		CaptureSettings capture_settings;
+		capture_settings.max_voices = settings.max_voices;
+		capture_settings.max_real_voices = settings.max_real_voices;
+		capture_settings.block_size = mix_samples;
+		capture_settings.mix_threads = settings.mix_threads;
+		capture_settings.far_radii = settings.far_radii;
+		capture_settings.buses = settings.buses;
+		capture_settings.ambisonic_buses = settings.ambisonic_buses;
+		capture.reset(new CaptureWriter(settings.capture_file, capture_settings));
+	}
+	capturing = bool(capture);
+
+	offline = !settings.open_device;
+	render_buffer.assign(MAX_MIX_SAMPLES, LR{0.0f, 0.0f});
+	render_buffer_frames = render_buffer_used = 0;
+
+	//keep everything the mixer touches in memory (see Settings::realtime):
+	if (realtime) lock_buffers();
+
+	if (offline) return;
 
-void Sound::init() {
 	if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
 		std::cerr << "Failed to initialize SDL audio subsytem:\n" << SDL_GetError() << std::endl;
 		std::cerr << "  (Will continue without audio.)\n" << std::endl;
 		return;
 	}
 
+	open_device();
+	if (device != 0) {
+		std::cout << "Audio output initialized." << std::endl;
+	}
+}
+
+void Sound::set_block_size(uint32_t block_size) {
+	if (offline) {
+		//the next block rendered will be the new size:
+		set_mix_samples(block_size);
+		capture_block_size();
+		return;
+	}
+	if (device == 0) {
+		set_mix_samples(block_size);
+		capture_block_size();
+		return;
+	}
+
+	//close the device (this waits for the audio callback to finish), then reopen it with the new block size:
+	// (all playback state lives outside the device, so everything picks up where it left off)
+	SDL_CloseAudioDevice(device);
+	device = 0;
+	set_mix_samples(block_size);
+	capture_block_size();
+	open_device();
+}
+
+uint32_t Sound::block_size() {
+	return mix_samples;
+}
+
+
+void Sound::shutdown() {
+	if (device != 0) {
+		//stop audio playback:
+		SDL_PauseAudioDevice(device, 1);
+		SDL_CloseAudioDevice(device);
+		device = 0;
+	}
+	stop_mix_workers();
+	unlock_buffers();
+
+	//with the audio thread stopped, effect lists it hasn't handed back can be freed here:
+	drain_commands();
+	free_retired_effects();
+
+	close_capture();
+}
+
+
+void Sound::render(float *out, uint32_t frames, uint64_t *voices_mixed) {
+	assert(offline && "Sound::render() requires Settings::open_device = false");
+	while (frames > 0) {
+		if (render_buffer_used == render_buffer_frames) {
+			mix_audio(nullptr, reinterpret_cast< Uint8 * >(render_buffer.data()), int(mix_samples * sizeof(LR)));
+			render_buffer_frames = mix_samples;
+			render_buffer_used = 0;
+			if (voices_mixed) *voices_mixed += voices_mixed_last_block;
+		}
+		uint32_t count = std::min(frames, render_buffer_frames - render_buffer_used);
+		std::copy(&render_buffer[render_buffer_used].l, &render_buffer[render_buffer_used].l + 2 * count, out);
+		render_buffer_used += count;
+		out += 2 * count;
+		frames -= count;
+	}
+}
+
+Sound::Stats const &Sound::stats() {
+	BlockStats block;
+	while (block_stats.pop(&block)) {
+		collected_stats.max_mix_seconds = std::max(collected_stats.max_mix_seconds, block.mix_seconds);
+		collected_stats.peak = std::max(collected_stats.peak, block.peak);
+		collected_stats.history.emplace_back(block);
+		if (collected_stats.history.size() > STATS_HISTORY) collected_stats.history.pop_front();
+	}
+	collected_stats.blocks = stats_blocks.load(std::memory_order_relaxed);
+	collected_stats.missed_deadlines = stats_missed_deadlines.load(std::memory_order_relaxed);
+	collected_stats.dropped = stats_dropped.load(std::memory_order_relaxed);
+	return collected_stats;
+}
+
+void Sound::write_stats_csv(std::string const &filename) {
+	Stats const &current = stats();
+	std::ofstream out(filename);
+	if (!out) throw std::runtime_error("Failed to open '" + filename + "' for writing.");
+	out << "block,mix_ms,deadline_ms,voices_playing,voices_far,voices_mixed,voices_finished,peak,missed_deadline\n";
+	for (auto const &block : current.history) {
+		out << block.block
+			<< ',' << block.mix_seconds * 1000.0f
+			<< ',' << block.frames * 1000.0f / float(AUDIO_RATE)
+			<< ',' << block.voices_playing
+			<< ',' << block.voices_far
+			<< ',' << block.voices_mixed
+			<< ',' << block.voices_finished
+			<< ',' << block.peak
+			<< ',' << (block.missed_deadline ? 1 : 0)
+			<< '\n';
+	}
+	if (!out) throw std::runtime_error("Failed to write '" + filename + "'.");
+}
+
+void Sound::lock() {
+	if (realtime && device) {
+		static bool warned = false;
+		if (!warned) {
+			std::cerr << "WARNING: Sound::lock() called in real-time mode; the audio thread will wait (and may miss its deadline) until Sound::unlock()." << std::endl;
+			warned = true;
+		}
+	}
+	if (device) SDL_LockAudioDevice(device);
+}
+
+void Sound::unlock() {
+	if (device) SDL_UnlockAudioDevice(device);
+}
+
+Sound::PlayingSample Sound::play(Sample const &sample, float play_volume, float pan) {
+	Voice voice;
+	voice.sample = &sample;
+	voice.volume = play_volume;
+	voice.pan = pan;
+	return start_voice(voice);
+}
+
+Sound::PlayingSample Sound::play_3D(Sample const &sample, float play_volume, glm::vec3 const &position, float half_volume_radius) {
+	Voice voice;
+	voice.sample = &sample;
+	voice.volume = play_volume;
+	voice.position = position;
+	voice.half_volume_radius = half_volume_radius;
+	return start_voice(voice);
+}
+
+Sound::PlayingSample Sound::loop(Sample const &sample, float play_volume, float pan) {
+	Voice voice;
+	voice.sample = &sample;
+	voice.loop = true;
+	voice.volume = play_volume;
+	voice.pan = pan;
+	return start_voice(voice);
+}
+
+Sound::PlayingSample Sound::loop_3D(Sample const &sample, float play_volume, glm::vec3 const &position, float half_volume_radius) {
+	Voice voice;
+	voice.sample = &sample;
+	voice.loop = true;
+	voice.volume = play_volume;
+	voice.position = position;
+	voice.half_volume_radius = half_volume_radius;
+	return start_voice(voice);
+}
+
+//helper: convert an audio clock time (in seconds) to a start time for Voice::start:
+uint64_t start_sample(double time) {
+	if (!(time > 0.0)) return 0; //(right away)
+	return uint64_t(std::llround(time * AUDIO_RATE));
+}
+
+Sound::PlayingSample Sound::play_at(Sample const &sample, double time, float play_volume, float pan) {
+	Voice voice;
+	voice.sample = &sample;
+	voice.start = start_sample(time);
+	voice.volume = play_volume;
+	voice.pan = pan;
+	return start_voice(voice);
+}
+
+Sound::PlayingSample Sound::play_3D_at(Sample const &sample, double time, float play_volume, glm::vec3 const &position, float half_volume_radius) {
+	Voice voice;
+	voice.sample = &sample;
+	voice.start = start_sample(time);
+	voice.volume = play_volume;
+	voice.position = position;
+	voice.half_volume_radius = half_volume_radius;
+	return start_voice(voice);
+}
+
+Sound::PlayingSample Sound::loop_at(Sample const &sample, double time, float play_volume, float pan) {
+	Voice voice;
+	voice.sample = &sample;
+	voice.start = start_sample(time);
+	voice.loop = true;
+	voice.volume = play_volume;
+	voice.pan = pan;
+	return start_voice(voice);
+}
+
+Sound::PlayingSample Sound::loop_3D_at(Sample const &sample, double time, float play_volume, glm::vec3 const &position, float half_volume_radius) {
+	Voice voice;
+	voice.sample = &sample;
+	voice.start = start_sample(time);
+	voice.loop = true;
+	voice.volume = play_volume;
+	voice.position = position;
+	voice.half_volume_radius = half_volume_radius;
+	return start_voice(voice);
+}
+
+double Sound::audio_clock() {
+	return double(audio_clock_samples.load(std::memory_order_acquire)) / AUDIO_RATE;
+}
+
+Sound::PlayingSample Sound::play(Stream &stream, float play_volume, float pan) {
+	stream.decoder->loop = false;
+	stream.decoder->rewind_if_ended();
+	Voice voice;
+	voice.stream = stream.decoder.get();
+	voice.volume = play_volume;
+	voice.pan = pan;
+	return start_voice(voice);
+}
+
+Sound::PlayingSample Sound::loop(Stream &stream, float play_volume, float pan) {
+	stream.decoder->loop = true;
+	stream.decoder->rewind_if_ended();
+	Voice voice;
+	voice.stream = stream.decoder.get();
+	voice.loop = true;
+	voice.volume = play_volume;
+	voice.pan = pan;
+	return start_voice(voice);
+}
+
+void Sound::stop_all_samples() {
+	Command command;
+	command.type = Command::StopAll;
+	push_command(command);
+}
+
+void Sound::set_volume(float new_volume, float ramp) {
+	Command command;
+	command.type = Command::SetGlobalVolume;
+	command.value = new_volume;
+	command.ramp = ramp;
+	push_command(command);
+}
+
+//------------------
+
+void Sound::PlayingSample::set_volume(float new_volume, float ramp) const {
+	Command command;
+	command.type = Command::SetVolume;
+	command.slot = slot;
+	command.generation = generation;
+	command.value = new_volume;
+	command.ramp = ramp;
+	push_command(command);
+}
+
+void Sound::PlayingSample::set_pan(float new_pan, float ramp) const {
+	Command command;
+	command.type = Command::SetPan;
+	command.slot = slot;
+	command.generation = generation;
+	command.value = new_pan;
+	command.ramp = ramp;
+	push_command(command);
+}
+
+void Sound::PlayingSample::set_position(glm::vec3 const &new_position, float ramp) const {
+	Command command;
+	command.type = Command::SetPosition;
+	command.slot = slot;
+	command.generation = generation;
+	command.a = new_position;
+	command.ramp = ramp;
+	push_command(command);
+}
+
+void Sound::PlayingSample::set_half_volume_radius(float new_radius, float ramp) const {
+	Command command;
+	command.type = Command::SetHalfVolumeRadius;
+	command.slot = slot;
+	command.generation = generation;
+	command.value = new_radius;
+	command.ramp = ramp;
+	push_command(command);
+}
+
+void Sound::PlayingSample::set_rate(float new_rate, float ramp) const {
+	Command command;
+	command.type = Command::SetRate;
+	command.slot = slot;
+	command.generation = generation;
+	command.value = new_rate;
+	command.ramp = ramp;
+	push_command(command);
+}
+
+void Sound::PlayingSample::set_bus(Bus const &bus) const {
+	Command command;
+	command.type = Command::SetBus;
+	command.slot = slot;
+	command.generation = generation;
+	command.int_value = int32_t(bus.index);
+	push_command(command);
+}
+
+void Sound::PlayingSample::set_priority(int32_t new_priority) const {
+	Command command;
+	command.type = Command::SetPriority;
+	command.slot = slot;
+	command.generation = generation;
+	command.int_value = new_priority;
+	push_command(command);
+}
+
+void Sound::PlayingSample::stop(float ramp) const {
+	Command command;
+	command.type = Command::Stop;
+	command.slot = slot;
+	command.generation = generation;
+	command.ramp = ramp;
+	push_command(command);
+}
+
+bool Sound::PlayingSample::stopped() const {
+	if (slot >= voices.size()) return true;
+	return generations[slot].load(std::memory_order_acquire) != generation;
+}
+
+//------------------
+
+Sound::Bus Sound::get_bus(std::string const &name) {
+	for (uint32_t b = 0; b < buses.size(); ++b) {
+		if (buses[b].name == name) {
+			Bus bus;
+			bus.index = b;
+			return bus;
+		}
+	}
+	throw std::runtime_error("No bus named '" + name + "'.");
+}
+
+void Sound::Bus::set_volume(float new_volume, float ramp) const {
+	Command command;
+	command.type = Command::SetBusVolume;
+	command.int_value = int32_t(index);
+	command.value = new_volume;
+	command.ramp = ramp;
+	push_command(command);
+}
+
+void Sound::Bus::set_effects(std::vector< Effect * > const &effects) const {
+	if (index >= buses.size()) return;
+	free_retired_effects();
+	//the new list is allocated here and swapped in by the audio thread, which hands back the old one to free later:
+	Command command;
+	command.type = Command::SetBusEffects;
+	command.int_value = int32_t(index);
+	command.effects = new std::vector< Effect * >(effects);
+	push_command(command);
+}
+
+//------------------
+
+void Sound::Listener::set_position_right(glm::vec3 const &new_position, glm::vec3 const &new_right, float ramp) {
+	Command command;
+	command.type = Command::SetListener;
+	command.a = new_position;
+	//some extra code to make sure right is always a unit vector:
+	// (vectors that already are -- to within rounding -- are kept as-is, so a replayed capture sets exactly the captured value)
+	float length2 = glm::dot(new_right, new_right);
+	if (new_right == glm::vec3(0.0f)) {
+		command.b = glm::vec3(1.0f, 0.0f, 0.0f);
+	} else if (std::abs(length2 - 1.0f) <= 1e-6f) {
+		command.b = new_right;
+	} else {
+		command.b = glm::normalize(new_right);
+	}
+	command.ramp = ramp;
+	push_command(command);
+}
+
+//------------------------ internals --------------------------------
+
+//helper: open (and start) the audio device at the current block size:
+void open_device() {
+	assert(device == 0);
+
 	//Based on the example on https://wiki.libsdl.org/SDL_OpenAudioDevice
 	SDL_AudioSpec want, have;
 	SDL_zero(want);
 	want.freq = AUDIO_RATE;
 	want.format = AUDIO_F32SYS;
 	want.channels = 2;
-	want.samples = MIX_SAMPLES;
+	want.samples = Uint16(mix_samples);
 	want.callback = mix_audio;
 
+	audio_thread_configured = false; //(SDL may start a new audio thread)
 	device = SDL_OpenAudioDevice(nullptr, 0, &want, &have, 0);
 	if (device == 0) {
 		std::cerr << "Failed to open audio device:\n" << SDL_GetError() << std::endl;
@@ -76,137 +1351,623 @@ void Sound::init() {
 	} else {
 		//start audio playback:
 		SDL_PauseAudioDevice(device, 0);
-		std::cout << "Audio output initialized." << std::endl;
 	}
 }
 
+//helper: set the block size (only call when the audio callback can't be running):
+void set_mix_samples(uint32_t block_size) {
+	//round to a power of two in the allowed range:
+	uint32_t size = MIN_MIX_SAMPLES;
+	while (size < block_size && size < MAX_MIX_SAMPLES) size *= 2;
+	if (size != block_size) {
+		std::cerr << "WARNING: Sound block size " << block_size << " isn't a power of two from " << MIN_MIX_SAMPLES << " to " << MAX_MIX_SAMPLES << "; using " << size << "." << std::endl;
+	}
+	mix_samples = size;
+	ramp_step = float(mix_samples) / float(AUDIO_RATE);
+	collected_stats.deadline_seconds = ramp_step;
+}
 
-void Sound::shutdown() {
-	if (device != 0) {
-		//stop audio playback:
-		SDL_PauseAudioDevice(device, 1);
-		SDL_CloseAudioDevice(device);
-		device = 0;
+
+//helper: claim a free voice slot and queue it to start playing (game thread):
+Sound::PlayingSample start_voice(Voice const &voice) {
+	Sound::PlayingSample handle;
+
+	uint32_t slot;
+	if (!free_voices.pop(&slot)) {
+		//pool is exhausted (or Sound::init() wasn't called); return an empty handle:
+		static bool warned = false;
+		if (!warned) {
+			std::cerr << "WARNING: Sound voice pool is full (" << voices.size() << " voices); some samples will not play." << std::endl;
+			warned = true;
+		}
+		return handle;
+	}
+
+	//(finish_voice() decrements 'voices' when the mixer is done with the sample)
+	if (voice.sample) {
+		voice.sample->voices.fetch_add(1, std::memory_order_relaxed);
+		voice.sample->last_played = ++play_count;
 	}
+
+	//slot is free, so the audio thread isn't looking at it:
+	voices[slot] = voice;
+	voices[slot].bus = (voice.stream ? default_stream_bus : default_sample_bus);
+	if (capture) voices[slot].capture_source = capture_source(voice);
+	handle.slot = slot;
+	handle.generation = generations[slot].load(std::memory_order_relaxed);
+
+	Command command;
+	command.type = Command::Play;
+	command.slot = handle.slot;
+	command.generation = handle.generation;
+	push_command(command);
+
+	return handle;
 }
 
+//helper: return a voice's slot to the pool (audio thread):
+void release_voice(uint32_t slot) {
+	if (voices[slot].sample) {
+		//(release, so the sample's memory can be reused once SampleCache sees no voices)
+		voices[slot].sample->voices.fetch_sub(1, std::memory_order_release);
+	}
+	voices[slot].sample = nullptr;
+	voices[slot].stream = nullptr;
+	voices[slot].active_index = -1U;
+	voices[slot].far = false;
+	generations[slot].fetch_add(1, std::memory_order_release);
+	bool freed = free_voices.push(slot);
+	assert(freed && "free list has room for every slot");
+	(void)freed;
+}
 
-void Sound::lock() {
-	if (device) SDL_LockAudioDevice(device);
+//helper: release a finished voice back to the pool (audio thread):
+void finish_voice(uint32_t active_index) {
+	assert(active_index < active_voices.size());
+	release_voice(active_voices[active_index]);
+	remove_active_voice(active_index);
 }
 
-void Sound::unlock() {
-	if (device) SDL_UnlockAudioDevice(device);
+//helper: take the voice at 'active_index' out of the active list:
+void remove_active_voice(uint32_t active_index) {
+	//move the last voice (and its parameters) into the vacated index:
+	active_voices[active_index] = active_voices.back();
+	active_voices.pop_back();
+	params.for_each_array([active_index](std::vector< float > &array) {
+		array[active_index] = array.back();
+		array.pop_back();
+	});
+	if (active_index < active_voices.size()) {
+		voices[active_voices[active_index]].active_index = active_index;
+	}
 }
 
-std::shared_ptr< Sound::PlayingSample > Sound::play(Sample const &sample, float play_volume, float pan) {
-	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, play_volume, pan, false);
-	lock();
-	playing_samples.emplace_back(playing_sample);
-	unlock();
-	return playing_sample;
+//helper: start a ramp at 'value' (in index 'index' of 'ramps'):
+void init_ramp(RampArray &ramps, uint32_t index, float value) {
+	assert(index == ramps.value.size());
+	ramps.value.emplace_back(value);
+	ramps.target.emplace_back(value);
+	ramps.ramp.emplace_back(0.0f);
 }
 
-std::shared_ptr< Sound::PlayingSample > Sound::play_3D(Sample const &sample, float play_volume, glm::vec3 const &position, float half_volume_radius) {
-	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, play_volume, position, half_volume_radius, false);
-	lock();
-	playing_samples.emplace_back(playing_sample);
-	unlock();
-	return playing_sample;
+//helper: same as Sound::Ramp::set(), for the ramp in index 'index' of 'ramps':
+void set_ramp(RampArray &ramps, uint32_t index, float value, float ramp) {
+	if (ramp <= 0.0f) {
+		ramps.value[index] = ramps.target[index] = value;
+		ramps.ramp[index] = 0.0f;
+	} else {
+		ramps.target[index] = value;
+		ramps.ramp[index] = ramp;
+	}
 }
 
-std::shared_ptr< Sound::PlayingSample > Sound::loop(Sample const &sample, float play_volume, float pan) {
-	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, play_volume, pan, true);
-	lock();
-	playing_samples.emplace_back(playing_sample);
-	unlock();
-	return playing_sample;
+//helper: add a voice that is starting to play to the active list (audio thread):
+void activate_voice(uint32_t slot) {
+	Voice &voice = voices[slot];
+	voice.active_index = uint32_t(active_voices.size());
+	active_voices.emplace_back(slot);
+
+	init_ramp(params.volume, voice.active_index, voice.volume);
+	init_ramp(params.pan, voice.active_index, voice.pan);
+	init_ramp(params.x, voice.active_index, voice.position.x);
+	init_ramp(params.y, voice.active_index, voice.position.y);
+	init_ramp(params.z, voice.active_index, voice.position.z);
+	init_ramp(params.half_volume_radius, voice.active_index, voice.half_volume_radius);
+	init_ramp(params.rate, voice.active_index, voice.rate);
+	params.ambisonic.emplace_back(buses[voice.bus].ambisonic ? 1.0f : 0.0f);
+	for (std::vector< float > *array : params.block_arrays()) {
+		array->emplace_back(0.0f);
+	}
 }
 
+//helper: start fading out a voice:
+void stop_voice(Voice &voice, float ramp) {
+	uint32_t index = voice.active_index;
+	if (!voice.stopping) {
+		voice.stopping = true;
+		params.volume.target[index] = 0.0f;
+		params.volume.ramp[index] = ramp;
+	} else {
+		params.volume.ramp[index] = std::min(params.volume.ramp[index], ramp);
+	}
+}
+
+//Far voices (see far_voices, above; all audio thread):
+
+//helper: distance from the listener at which a voice with the given half-volume radius is far:
+float far_range(float half_volume_radius) {
+	return far_radii * half_volume_radius;
+}
+
+//helper: spatial hash bucket for a cell:
+uint32_t far_bucket(int32_t x, int32_t y, int32_t z) {
+	uint32_t hash = uint32_t(x) * 73856093U ^ uint32_t(y) * 19349663U ^ uint32_t(z) * 83492791U;
+	return hash & uint32_t(far_cells.size() - 1);
+}
+
+//helper: cell containing 'position':
+glm::ivec3 far_cell(glm::vec3 const &position) {
+	return glm::ivec3(glm::floor(position / far_cell_size));
+}
+
+//helper: add a far voice to the spatial hash (by its position):
+void link_far_voice(uint32_t slot) {
+	Voice &voice = voices[slot];
+	glm::ivec3 cell = far_cell(voice.position);
+	voice.far_bucket = far_bucket(cell.x, cell.y, cell.z);
+	voice.far_prev = -1U;
+	voice.far_next = far_cells[voice.far_bucket];
+	if (voice.far_next != -1U) voices[voice.far_next].far_prev = slot;
+	far_cells[voice.far_bucket] = slot;
+}
+
+//helper: remove a far voice from the spatial hash:
+void unlink_far_voice(uint32_t slot) {
+	Voice &voice = voices[slot];
+	if (voice.far_prev != -1U) voices[voice.far_prev].far_next = voice.far_next;
+	else far_cells[voice.far_bucket] = voice.far_next;
+	if (voice.far_next != -1U) voices[voice.far_next].far_prev = voice.far_prev;
+	voice.far_bucket = voice.far_next = voice.far_prev = -1U;
+}
+
+//helper: make sure cells are at least 'range' across (re-hashing every far voice if they need to grow):
+void fit_far_cells(float range) {
+	if (range <= far_cell_size) return;
+	float size = std::max(1.0f, far_cell_size);
+	while (size < range) size *= 2.0f; //(doubling, so re-hashing is rare)
+	far_cell_size = size;
+	std::fill(far_cells.begin(), far_cells.end(), -1U);
+	for (uint32_t slot : far_voices) {
+		link_far_voice(slot);
+	}
+}
+
+//helper: bring a far voice's playhead up to the start of this block:
+void catch_up_far_voice(Voice &voice) {
+	uint64_t from = std::max(voice.far_since, voice.start); //(scheduled voices don't move until they start)
+	if (block_clock > from && voice.rate > 0.0f) {
+		advance_playhead(voice, double(voice.rate) * double(block_clock - from));
+	}
+	voice.far_since = block_clock;
+}
+
+//helper: audio clock time a far one-shot voice will end (-1 if it won't):
+uint64_t far_end(Voice const &voice) {
+	if (voice.loop || !(voice.rate > 0.0f)) return uint64_t(-1);
+	double remaining = (double(voice.sample->length) - double(voice.i) - double(voice.frac)) / voice.rate;
+	return std::max(voice.far_since, voice.start) + uint64_t(std::ceil(std::max(0.0, remaining)));
+}
+
+//helper: (re)schedule the end of a far voice, making any earlier entry stale:
+void schedule_far_end(uint32_t slot) {
+	auto later = [](FarEnd const &a, FarEnd const &b) { return a.end > b.end; };
+	voices[slot].far_serial += 1;
+	if (far_ends.size() == far_ends.capacity()) {
+		//(full of stale entries -- capacity is twice the voice count -- so rebuild from the far voices instead of allocating)
+		far_ends.clear();
+		for (uint32_t s : far_voices) {
+			if (s == slot) continue;
+			uint64_t end = far_end(voices[s]);
+			if (end != uint64_t(-1)) far_ends.emplace_back(FarEnd{end, s, voices[s].far_serial});
+		}
+		std::make_heap(far_ends.begin(), far_ends.end(), later);
+	}
+	uint64_t end = far_end(voices[slot]);
+	if (end == uint64_t(-1)) return;
+	far_ends.emplace_back(FarEnd{end, slot, voices[slot].far_serial});
+	std::push_heap(far_ends.begin(), far_ends.end(), later);
+}
+
+//helper: set aside the (already silent) voice at 'active_index' as far:
+void park_voice(uint32_t active_index) {
+	uint32_t slot = active_voices[active_index];
+	Voice &voice = voices[slot];
+
+	//keep the voice's parameters (snapped to their targets -- nothing is heard while far):
+	voice.volume = params.volume.target[active_index];
+	voice.position = glm::vec3(params.x.target[active_index], params.y.target[active_index], params.z.target[active_index]);
+	voice.half_volume_radius = params.half_volume_radius.target[active_index];
+	voice.rate = params.rate.target[active_index];
+	remove_active_voice(active_index);
+	voice.active_index = -1U;
+
+	voice.far = true;
+	voice.leaving = false;
+	voice.far_since = block_clock;
+	fit_far_cells(far_range(voice.half_volume_radius)); //(before adding the voice, since re-hashing links every far voice)
+	voice.far_index = uint32_t(far_voices.size());
+	far_voices.emplace_back(slot);
+	link_far_voice(slot);
+	schedule_far_end(slot);
+}
+
+//helper: take a voice out of far_voices and the spatial hash:
+void unpark_voice(uint32_t slot) {
+	Voice &voice = voices[slot];
+	unlink_far_voice(slot);
+	far_voices[voice.far_index] = far_voices.back();
+	voices[far_voices[voice.far_index]].far_index = voice.far_index;
+	far_voices.pop_back();
+	voice.far_index = -1U;
+	voice.far_serial += 1; //(its end, if scheduled, is stale)
+	voice.far = false;
+}
+
+//helper: bring a far voice that is back in range into the active list (it fades in):
+void return_far_voice(uint32_t slot) {
+	Voice &voice = voices[slot];
+	catch_up_far_voice(voice);
+	unpark_voice(slot);
+	voice.real = voice.was_real = false;
+	voice.fresh = false;
+	activate_voice(slot);
+}
+
+//helper: a far voice has finished (or been stopped):
+void finish_far_voice(uint32_t slot) {
+	unpark_voice(slot);
+	release_voice(slot);
+}
+
+//helper: apply a command to a far voice (in place of apply_command()'s handling):
+void apply_far_command(Command const &command, uint32_t slot) {
+	Voice &voice = voices[slot];
+	switch (command.type) {
+		case Command::SetVolume:
+			voice.volume = command.value;
+			break;
+		case Command::SetPosition:
+			unlink_far_voice(slot);
+			voice.position = command.a;
+			link_far_voice(slot);
+			break;
+		case Command::SetHalfVolumeRadius:
+			voice.half_volume_radius = command.value;
+			fit_far_cells(far_range(voice.half_volume_radius));
+			break;
+		case Command::SetRate:
+			catch_up_far_voice(voice);
+			voice.rate = std::max(0.0f, std::min(MAX_RATE, command.value));
+			schedule_far_end(slot);
+			break;
+		case Command::SetPriority:
+			voice.priority = command.int_value;
+			break;
+		case Command::SetBus:
+			if (uint32_t(command.int_value) < buses.size()) voice.bus = uint32_t(command.int_value);
+			break;
+		case Command::Stop:
+			finish_far_voice(slot); //(nothing to fade out)
+			break;
+		default:
+			break;
+	}
+}
+
+//helper: once per block, before computing gains -- finish far voices that have ended, bring back far voices in range,
+// and set aside (or start fading out) voices out of range; returns the number of voices finished:
+uint32_t update_far_voices(glm::vec3 const &listener_position) {
+	if (!(far_radii > 0.0f)) return 0;
+	uint32_t finished = 0;
+
+	//far one-shot voices that have ended:
+	auto later = [](FarEnd const &a, FarEnd const &b) { return a.end > b.end; };
+	while (!far_ends.empty() && far_ends.front().end <= block_clock) {
+		FarEnd end = far_ends.front();
+		std::pop_heap(far_ends.begin(), far_ends.end(), later);
+		far_ends.pop_back();
+		if (voices[end.slot].far && voices[end.slot].far_serial == end.serial) {
+			finish_far_voice(end.slot);
+			++finished;
+		}
+	}
+
+	//far voices back in range (all in the cells around the listener, since cells are at least any far voice's range):
+	if (!far_voices.empty()) {
+		glm::ivec3 center = far_cell(listener_position);
+		for (int32_t dz = -1; dz <= 1; ++dz) {
+			for (int32_t dy = -1; dy <= 1; ++dy) {
+				for (int32_t dx = -1; dx <= 1; ++dx) {
+					uint32_t slot = far_cells[far_bucket(center.x + dx, center.y + dy, center.z + dz)];
+					while (slot != -1U) {
+						Voice const &voice = voices[slot];
+						uint32_t next = voice.far_next;
+						if (glm::length(voice.position - listener_position) < FAR_RETURN * far_range(voice.half_volume_radius)) {
+							return_far_voice(slot);
+						}
+						slot = next;
+					}
+				}
+			}
+		}
+	}
+
+	//voices out of range fade out (see choose_real_voices()), then are set aside:
+	// (going backward, so the voice that park_voice() moves into 'active_index' has already been checked)
+	for (uint32_t active_index = uint32_t(active_voices.size()) - 1; active_index < active_voices.size(); --active_index) {
+		Voice &voice = voices[active_voices[active_index]];
+		voice.leaving = false;
+		if (voice.stream || voice.pan == voice.pan || voice.stopping) continue; //(only 3D samples, and stopping voices will soon finish anyway)
+		float range = far_range(params.half_volume_radius.target[active_index]);
+		if (!(range > 0.0f)) continue;
+		glm::vec3 position = glm::vec3(params.x.target[active_index], params.y.target[active_index], params.z.target[active_index]);
+		if (!(glm::length(position - listener_position) > range)) continue;
+		if (voice.real || voice.sample->loading.load(std::memory_order_acquire)) {
+			voice.leaving = true;
+		} else {
+			park_voice(active_index);
+		}
+	}
 
+	return finished;
+}
 
-std::shared_ptr< Sound::PlayingSample > Sound::loop_3D(Sample const &sample, float play_volume, glm::vec3 const &position, float half_volume_radius) {
-	std::shared_ptr< Sound::PlayingSample > playing_sample = std::make_shared< Sound::PlayingSample >(sample, play_volume, position, half_volume_radius, true);
-	lock();
-	playing_samples.emplace_back(playing_sample);
-	unlock();
-	return playing_sample;
+//Command capture (see Settings::capture_file and sound_capture.hpp):
+
+//helper: record a command as it is applied (audio thread, or with the audio thread locked out):
+void capture_command(Command const &command) {
+	//(capture command types are listed in the same order as Command::Type)
+	static_assert(int(CaptureCommand::Play) == int(Command::Play), "capture types match command types");
+	static_assert(int(CaptureCommand::SetListener) == int(Command::SetListener), "capture types match command types");
+	static_assert(int(CaptureCommand::SetBusEffects) == int(Command::SetBusEffects), "capture types match command types");
+
+	CaptureCommand record;
+	record.type = CaptureCommand::Type(command.type);
+	record.block = blocks_mixed;
+	record.slot = command.slot;
+	record.generation = command.generation;
+	record.int_value = command.int_value;
+	record.a = command.a;
+	record.b = command.b;
+	record.value = command.value;
+	record.ramp = command.ramp;
+	if (command.type == Command::Play && command.slot < voices.size()) {
+		//(the game thread set up the voice's starting state before sending Play)
+		Voice const &voice = voices[command.slot];
+		record.source = voice.capture_source;
+		record.loop = voice.loop;
+		record.start = voice.start;
+		record.volume = voice.volume;
+		record.pan = voice.pan;
+		record.position = voice.position;
+		record.half_volume_radius = voice.half_volume_radius;
+	}
+	if (!captured.push(record)) capture_dropped.store(true, std::memory_order_relaxed);
 }
 
+//helper: where a sample's data is stored (to tell samples at the same address apart):
+void const *sample_storage(Sound::Sample const &sample) {
+	if (sample.format == Sound::Sample::Int16) return sample.data16.data();
+	if (sample.format == Sound::Sample::ADPCM) return sample.adpcm.data();
+	return sample.floats();
+}
 
-void Sound::stop_all_samples() {
-	lock();
-	for (auto &s : playing_samples) {
-		s->stop();
+//helper: the capture's id for a voice's sample or stream, writing it to the capture the first time it is played (game thread):
+uint32_t capture_source(Voice const &voice) {
+	assert(capture);
+	void const *key = (voice.sample ? static_cast< void const * >(voice.sample) : static_cast< void const * >(voice.stream));
+	void const *data = (voice.sample ? sample_storage(*voice.sample) : nullptr);
+	auto f = capture_sources.find(key);
+	if (f != capture_sources.end() && f->second.data == data) return f->second.id;
+
+	uint32_t id = capture_source_count++;
+	capture_sources[key] = CaptureSource{id, data};
+	if (voice.stream) {
+		capture->stream(id, voice.stream->filename);
+	} else if (voice.sample->loading.load(std::memory_order_acquire)) {
+		capture_loading.emplace_back(id, voice.sample);
+	} else {
+		capture->sample(id, *voice.sample);
 	}
-	unlock();
+	return id;
 }
 
-void Sound::set_volume(float new_volume, float ramp) {
-	lock();
-	volume.set(new_volume, ramp);
-	unlock();
+//helper: record a block size change (game thread, while the audio callback can't be running):
+void capture_block_size() {
+	if (!capture) return;
+	flush_capture();
+	CaptureCommand record;
+	record.type = CaptureCommand::SetBlockSize;
+	record.block = blocks_mixed; //(the next block mixed is the new size)
+	record.int_value = int32_t(mix_samples);
+	capture->command(record);
 }
 
-//------------------
+//helper: write out the commands the mixer has recorded, and samples that have finished loading (game thread):
+void flush_capture() {
+	assert(capture);
+	for (uint32_t i = 0; i < capture_loading.size(); /* later */) {
+		if (!capture_loading[i].second->loading.load(std::memory_order_acquire)) {
+			capture->sample(capture_loading[i].first, *capture_loading[i].second);
+			capture_loading[i] = capture_loading.back();
+			capture_loading.pop_back();
+		} else {
+			++i;
+		}
+	}
 
-void Sound::PlayingSample::set_volume(float new_volume, float ramp) {
-	Sound::lock();
-	if (!stopping) {
-		volume.set(new_volume, ramp);
+	CaptureCommand record;
+	while (captured.pop(&record)) {
+		capture->command(record);
+	}
+
+	if (capture_dropped.exchange(false, std::memory_order_relaxed)) {
+		std::cerr << "WARNING: sound capture '" << capture->filename << "' dropped some commands; replaying it won't match." << std::endl;
 	}
-	Sound::unlock();
 }
 
-void Sound::PlayingSample::set_pan(float new_pan, float ramp) {
-	if (!(pan.value == pan.value)) return; //ignore if not in '2D' mode
-	Sound::lock();
-	pan.set(new_pan, ramp);
-	Sound::unlock();
+//helper: finish the capture (game thread, with the audio callback stopped):
+void close_capture() {
+	if (!capture) return;
+	flush_capture();
+	for (auto const &[id, sample] : capture_loading) {
+		//(still loading -- written empty, so that the capture can still be replayed)
+		std::cerr << "WARNING: a sample played while capturing hadn't loaded by shutdown; it will replay as silence." << std::endl;
+		capture->sample(id, Sound::Sample());
+	}
+	capture_loading.clear();
+	capture->end(blocks_mixed);
+	capture.reset();
+	capturing = false;
 }
 
-void Sound::PlayingSample::set_position(glm::vec3 const &new_position, float ramp) {
-	if (pan.value == pan.value) return; //ignore if not in '3D' mode
-	Sound::lock();
-	position.set(new_position, ramp);
-	Sound::unlock();
+//helper: apply one command (runs on the audio thread, or with the audio thread locked out):
+void apply_command(Command const &command) {
+	if (capturing) capture_command(command);
+
+	Voice *target = nullptr;
+	if (command.slot < voices.size()) {
+		//ignore commands for voices that have already finished:
+		if (generations[command.slot].load(std::memory_order_relaxed) != command.generation) return;
+		target = &voices[command.slot];
+		if (target->far && command.type != Command::Play) {
+			apply_far_command(command, command.slot);
+			return;
+		}
+	}
+	switch (command.type) {
+		case Command::Play:
+			assert(target);
+			activate_voice(command.slot);
+			break;
+		case Command::SetVolume:
+			if (!target->stopping) {
+				set_ramp(params.volume, target->active_index, command.value, command.ramp);
+			}
+			break;
+		case Command::SetPan:
+			if (!(target->pan == target->pan)) break; //ignore if not in '2D' mode
+			set_ramp(params.pan, target->active_index, command.value, command.ramp);
+			break;
+		case Command::SetPosition:
+			if (target->pan == target->pan) break; //ignore if not in '3D' mode
+			set_ramp(params.x, target->active_index, command.a.x, command.ramp);
+			set_ramp(params.y, target->active_index, command.a.y, command.ramp);
+			set_ramp(params.z, target->active_index, command.a.z, command.ramp);
+			break;
+		case Command::SetHalfVolumeRadius:
+			if (target->pan == target->pan) break; //ignore if not in '3D' mode
+			set_ramp(params.half_volume_radius, target->active_index, command.value, command.ramp);
+			break;
+		case Command::SetRate:
+			if (target->stream) break; //streams always play at their own rate
+			set_ramp(params.rate, target->active_index, std::max(0.0f, std::min(MAX_RATE, command.value)), command.ramp);
+			break;
+		case Command::SetPriority:
+			target->priority = command.int_value;
+			break;
+		case Command::SetBus:
+			if (uint32_t(command.int_value) < buses.size()) {
+				target->bus = uint32_t(command.int_value);
+				params.ambisonic[target->active_index] = (buses[target->bus].ambisonic ? 1.0f : 0.0f);
+			}
+			break;
+		case Command::Stop:
+			stop_voice(*target, command.ramp);
+			break;
+		case Command::StopAll:
+			for (uint32_t slot : active_voices) {
+				stop_voice(voices[slot], 1.0f / 60.0f);
+			}
+			while (!far_voices.empty()) {
+				finish_far_voice(far_voices.back());
+			}
+			break;
+		case Command::SetListener:
+			Sound::listener.position.set(command.a, command.ramp);
+			Sound::listener.right.set(command.b, command.ramp);
+			break;
+		case Command::SetGlobalVolume:
+			Sound::volume.set(command.value, command.ramp);
+			break;
+		case Command::SetBusVolume:
+			if (uint32_t(command.int_value) < buses.size()) buses[command.int_value].volume.set(command.value, command.ramp);
+			break;
+		case Command::SetBusEffects:
+			if (uint32_t(command.int_value) < buses.size()) buses[command.int_value].effects.swap(*command.effects);
+			//(retired_effects has room for every command that could be queued, so this shouldn't fail; if it does, leak rather than free here)
+			if (!retired_effects.push(command.effects)) {
+				assert(0 && "retired_effects has room for every SetBusEffects command");
+			}
+			break;
+	}
 }
 
-void Sound::PlayingSample::set_half_volume_radius(float new_radius, float ramp) {
-	if (pan.value == pan.value) return; //ignore if not in '3D' mode
-	Sound::lock();
-	half_volume_radius.set(new_radius, ramp);
-	Sound::unlock();
+//helper: free effect lists the audio thread has handed back (game thread):
+void free_retired_effects() {
+	std::vector< Sound::Effect * > *effects;
+	while (retired_effects.pop(&effects)) {
+		delete effects;
+	}
 }
 
-void Sound::PlayingSample::stop(float ramp) {
-	Sound::lock();
-	if (!(stopping || stopped)) {
-		stopping = true;
-		volume.target = 0.0f;
-		volume.ramp = ramp;
-	} else {
-		volume.ramp = std::min(volume.ramp, ramp);
+//helper: apply all pending commands:
+void drain_commands() {
+	Command command;
+	while (commands.pop(&command)) {
+		apply_command(command);
 	}
-	Sound::unlock();
 }
 
-//------------------
+//helper: send a command to the audio thread:
+void push_command(Command const &command) {
+	if (capture) flush_capture();
 
-void Sound::Listener::set_position_right(glm::vec3 const &new_position, glm::vec3 const &new_right, float ramp) {
-	Sound::lock();
-	position.set(new_position, ramp);
-	//some extra code to make sure right is always a unit vector:
-	if (new_right == glm::vec3(0.0f)) {
-		right.set(glm::vec3(1.0f, 0.0f, 0.0f), ramp);
-	} else {
-		right.set(glm::normalize(new_right), ramp);
+	if (commands.push(command)) return;
+
+	//Queue is full (e.g., a burst of commands, or there is no running audio device to drain it):
+	if (realtime && device != 0) {
+		//in strict real-time mode, never lock out the audio thread -- wait for it to drain the queue instead:
+		do {
+			std::this_thread::yield();
+		} while (!commands.push(command));
+		return;
 	}
+	// lock out the audio thread and apply everything from here instead.
+	Sound::lock();
+	drain_commands();
+	apply_command(command);
 	Sound::unlock();
 }
 
-//------------------------ internals --------------------------------
-
+//helper: fast cos/sin for panning -- computes cos(ang) and sin(ang) for ang = pi/4 * (amt + 1),
+// so amt in [-1,1] maps to ang in [0,pi/2]. Uses polynomials for sin/cos of (ang - pi/4) in [-pi/4,pi/4]
+// (truncated Taylor series; absolute error is below 1e-6 over the whole range).
+//The SIMD version in compute_voice_gains() uses the same polynomials.
+constexpr float const PAN_SIN_1 = -1.0f / 6.0f, PAN_SIN_2 = 1.0f / 120.0f, PAN_SIN_3 = -1.0f / 5040.0f;
+constexpr float const PAN_COS_1 = -1.0f / 2.0f, PAN_COS_2 = 1.0f / 24.0f, PAN_COS_3 = -1.0f / 720.0f, PAN_COS_4 = 1.0f / 40320.0f;
+constexpr float const QUARTER_PI = 0.785398163f;
+constexpr float const SQRT_HALF = 0.707106781f;
+
+inline void pan_cos_sin(float amt, float *cos_, float *sin_) {
+	float x = QUARTER_PI * amt;
+	float x2 = x * x;
+	float s = x * (1.0f + x2 * (PAN_SIN_1 + x2 * (PAN_SIN_2 + x2 * PAN_SIN_3)));
+	float c = 1.0f + x2 * (PAN_COS_1 + x2 * (PAN_COS_2 + x2 * (PAN_COS_3 + x2 * PAN_COS_4)));
+	//cos(x + pi/4) and sin(x + pi/4):
+	*cos_ = SQRT_HALF * (c - s);
+	*sin_ = SQRT_HALF * (c + s);
+}
 
 //helper: equal-power panning
 inline void compute_pan_weights(float pan, float *left, float *right) {
@@ -214,9 +1975,16 @@ inline void compute_pan_weights(float pan, float *left, float *right) {
 	pan = std::max(-1.0f, std::min(1.0f, pan));
 
 	//want left^2 + right^2 = 1.0, so use angles:
-	float ang = 0.5f * 3.1415926f * (0.5f * (pan + 1.0f));
-	*left = std::cos(ang);
-	*right = std::sin(ang);
+	pan_cos_sin(pan, left, right);
+}
+
+//helper: 3D distance attenuation
+inline float compute_attenuation(float distance, float source_half_radius) {
+	//squared distance attenuation is realistic if there are no walls,
+	// but I'm going to use linear because it's sounds better to me.
+	// (feel free to change it, of course)
+	//want att = 0.5f at distance == half_volume_radius
+	return 1.0f / (1.0f + (distance / source_half_radius));
 }
 
 //helper: 3D audio panning
@@ -237,48 +2005,42 @@ void compute_pan_from_listener_and_position(
 		//amt ranges from -1 (most left) to 1 (most right):
 		float amt = glm::dot(listener_right, to) / distance;
 		//turn into an angle from 0.0f (most left) to pi/2 (most right):
-		float ang = 0.5f * 3.1415926f * (0.5f * (amt + 1.0f));
-		*left = std::cos(ang);
-		*right = std::sin(ang);
-
-		//squared distance attenuation is realistic if there are no walls,
-		// but I'm going to use linear because it's sounds better to me.
-		// (feel free to change it, of course)
-		//want att = 0.5f at distance == half_volume_radius
-		float att = 1.0f / (1.0f + (distance / source_half_radius));
+		pan_cos_sin(amt, left, right);
+
+		float att = compute_attenuation(distance, source_half_radius);
 		*left *= att;
 		*right *= att;
 	}
 }
 
 //helper: ramp updates...
-constexpr float const RAMP_STEP = float(MIX_SAMPLES) / float(AUDIO_RATE);
+// (every update moves a ramp 'ramp_step' seconds along, so ramps take the same time whatever the block size)
 
 //helper: ...for single values:
 void step_value_ramp(Sound::Ramp< float > &ramp) {
-	if (ramp.ramp < RAMP_STEP) {
+	if (ramp.ramp < ramp_step) {
 		ramp.value = ramp.target;
 		ramp.ramp = 0.0f;
 	} else {
-		ramp.value += (RAMP_STEP / ramp.ramp) * (ramp.target - ramp.value);
-		ramp.ramp -= RAMP_STEP;
+		ramp.value += (ramp_step / ramp.ramp) * (ramp.target - ramp.value);
+		ramp.ramp -= ramp_step;
 	}
 }
 
 //helper: ...for 3D positions:
 void step_position_ramp(Sound::Ramp< glm::vec3 > &ramp) {
-	if (ramp.ramp < RAMP_STEP) {
+	if (ramp.ramp < ramp_step) {
 		ramp.value = ramp.target;
 		ramp.ramp = 0.0f;
 	} else {
-		ramp.value = glm::mix(ramp.value, ramp.target, RAMP_STEP / ramp.ramp);
-		ramp.ramp -= RAMP_STEP;
+		ramp.value = glm::mix(ramp.value, ramp.target, ramp_step / ramp.ramp);
+		ramp.ramp -= ramp_step;
 	}
 }
 
 //helper: ...for 3D directions:
 void step_direction_ramp(Sound::Ramp< glm::vec3 > &ramp) {
-	if (ramp.ramp < RAMP_STEP) {
+	if (ramp.ramp < ramp_step) {
 		ramp.value = ramp.target;
 		ramp.ramp = 0.0f;
 	} else {
@@ -302,30 +2064,827 @@ void step_direction_ramp(Sound::Ramp< glm::vec3 > &ramp) {
 		float angle = std::acos(glm::clamp(glm::dot(ramp.value, ramp.target), -1.0f, 1.0f));
 
 		//figure out new target value by moving angle toward target:
-		angle *= (ramp.ramp - RAMP_STEP) / ramp.ramp;
+		angle *= (ramp.ramp - ramp_step) / ramp.ramp;
 
 		ramp.value = ramp.target * std::cos(angle) + perp * std::sin(angle);
-		ramp.ramp -= RAMP_STEP;
+		ramp.ramp -= ramp_step;
+	}
+}
+
+
+//helper: ...for every voice's ramps in 'ramps' at once:
+void step_value_ramps(RampArray &ramps) {
+	uint32_t count = uint32_t(ramps.value.size());
+	float *value = ramps.value.data();
+	float const *target = ramps.target.data();
+	float *ramp = ramps.ramp.data();
+	uint32_t i = 0;
+#if defined(SOUND_MIX_AVX) || defined(SOUND_MIX_SSE)
+	__m128 const step = _mm_set1_ps(ramp_step);
+	for (; i + 4 <= count; i += 4) {
+		__m128 v = _mm_loadu_ps(value + i);
+		__m128 t = _mm_loadu_ps(target + i);
+		__m128 r = _mm_loadu_ps(ramp + i);
+		__m128 done = _mm_cmplt_ps(r, step);
+		//(lanes that are done may compute garbage here -- e.g., 0/0 -- but it is masked off below)
+		__m128 moved = _mm_add_ps(v, _mm_mul_ps(_mm_div_ps(step, r), _mm_sub_ps(t, v)));
+		_mm_storeu_ps(value + i, _mm_or_ps(_mm_and_ps(done, t), _mm_andnot_ps(done, moved)));
+		_mm_storeu_ps(ramp + i, _mm_andnot_ps(done, _mm_sub_ps(r, step)));
+	}
+#endif
+	for (; i < count; ++i) {
+		if (ramp[i] < ramp_step) {
+			value[i] = target[i];
+			ramp[i] = 0.0f;
+		} else {
+			value[i] += (ramp_step / ramp[i]) * (target[i] - value[i]);
+			ramp[i] -= ramp_step;
+		}
+	}
+}
+
+//helper: compute gains for every active voice, given listener position and global volume
+// (also fills in 'audibility' -- an estimate of how loud each voice is, used to pick which voices to mix -- if not null):
+//voices on ambisonic buses (see BusState::ambisonic) aren't panned at all; they get B-format gains instead -- W, X in 'out_l', 'out_r'; Y, Z in 'out_y', 'out_z':
+// 3D voices are encoded by their direction from the listener in world space, so this doesn't depend on which way the listener faces;
+// 2D voices are encoded toward the listener's right by their pan, so they stay put as the listener turns
+void compute_voice_gains(
+	glm::vec3 const &listener_position,
+	glm::vec3 const &listener_right,
+	float global_volume,
+	float *out_l, float *out_r, float *out_y, float *out_z, float *audibility
+	) {
+	uint32_t count = uint32_t(active_voices.size());
+	uint32_t i = 0;
+#if defined(SOUND_MIX_AVX) || defined(SOUND_MIX_SSE)
+	//same math as the scalar loop below, but four voices at a time;
+	// 2D and 3D voices are both computed, and the right result selected by whether pan is NaN
+	// (likewise stereo and B-format gains -- but each is skipped when none of the four voices needs it):
+	auto select = [](__m128 mask, __m128 a, __m128 b) {
+		return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+	};
+	__m128 const one = _mm_set1_ps(1.0f);
+	__m128 const zero = _mm_setzero_ps();
+	__m128 const lx = _mm_set1_ps(listener_position.x);
+	__m128 const ly = _mm_set1_ps(listener_position.y);
+	__m128 const lz = _mm_set1_ps(listener_position.z);
+	__m128 const rx = _mm_set1_ps(listener_right.x);
+	__m128 const ry = _mm_set1_ps(listener_right.y);
+	__m128 const rz = _mm_set1_ps(listener_right.z);
+	__m128 const gv = _mm_set1_ps(global_volume);
+	for (; i + 4 <= count; i += 4) {
+		__m128 pan = _mm_loadu_ps(params.pan.value.data() + i);
+		__m128 is_2D = _mm_cmpord_ps(pan, pan);
+		__m128 ambisonic = (any_ambisonic ? _mm_cmpneq_ps(_mm_loadu_ps(params.ambisonic.data() + i), zero) : zero);
+		int ambisonic_lanes = _mm_movemask_ps(ambisonic);
+
+		//3D: direction and distance to listener:
+		__m128 tx = _mm_sub_ps(_mm_loadu_ps(params.x.value.data() + i), lx);
+		__m128 ty = _mm_sub_ps(_mm_loadu_ps(params.y.value.data() + i), ly);
+		__m128 tz = _mm_sub_ps(_mm_loadu_ps(params.z.value.data() + i), lz);
+		__m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, tx), _mm_mul_ps(ty, ty)), _mm_mul_ps(tz, tz)));
+		__m128 att = _mm_div_ps(one, _mm_add_ps(one, _mm_div_ps(distance, _mm_loadu_ps(params.half_volume_radius.value.data() + i))));
+		att = select(is_2D, one, att);
+		__m128 at_listener = _mm_andnot_ps(is_2D, _mm_cmpeq_ps(distance, zero));
+
+		//2D: clamped pan:
+		pan = _mm_max_ps(_mm_set1_ps(-1.0f), _mm_min_ps(one, pan));
+
+		__m128 volume = _mm_loadu_ps(params.volume.value.data() + i);
+		__m128 gain = _mm_mul_ps(gv, volume);
+
+		//stereo voices -- equal-power pan weights (see pan_cos_sin()):
+		__m128 l = zero, r = zero;
+		if (ambisonic_lanes != 0xf) {
+			__m128 amt = _mm_div_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, tx), _mm_mul_ps(ry, ty)), _mm_mul_ps(rz, tz)), distance);
+			__m128 x = _mm_mul_ps(_mm_set1_ps(QUARTER_PI), select(is_2D, pan, amt));
+			__m128 x2 = _mm_mul_ps(x, x);
+			__m128 sin_x = _mm_add_ps(_mm_set1_ps(PAN_SIN_2), _mm_mul_ps(x2, _mm_set1_ps(PAN_SIN_3)));
+			sin_x = _mm_add_ps(_mm_set1_ps(PAN_SIN_1), _mm_mul_ps(x2, sin_x));
+			sin_x = _mm_mul_ps(x, _mm_add_ps(one, _mm_mul_ps(x2, sin_x)));
+			__m128 cos_x = _mm_add_ps(_mm_set1_ps(PAN_COS_3), _mm_mul_ps(x2, _mm_set1_ps(PAN_COS_4)));
+			cos_x = _mm_add_ps(_mm_set1_ps(PAN_COS_2), _mm_mul_ps(x2, cos_x));
+			cos_x = _mm_add_ps(_mm_set1_ps(PAN_COS_1), _mm_mul_ps(x2, cos_x));
+			cos_x = _mm_add_ps(one, _mm_mul_ps(x2, cos_x));
+			l = _mm_mul_ps(_mm_set1_ps(SQRT_HALF), _mm_sub_ps(cos_x, sin_x));
+			r = _mm_mul_ps(_mm_set1_ps(SQRT_HALF), _mm_add_ps(cos_x, sin_x));
+
+			//3D voices right at the listener aren't panned or attenuated:
+			__m128 sqrt_2 = _mm_set1_ps(std::sqrt(2.0f));
+			l = _mm_mul_ps(select(at_listener, sqrt_2, _mm_mul_ps(l, att)), gain);
+			r = _mm_mul_ps(select(at_listener, sqrt_2, _mm_mul_ps(r, att)), gain);
+		}
+
+		//ambisonic voices -- B-format gains, by direction (2D voices toward the listener's right; 3D voices at the listener have no direction):
+		if (ambisonic_lanes != 0) {
+			__m128 w = _mm_mul_ps(gain, att);
+			__m128 to_direction = _mm_andnot_ps(at_listener, _mm_div_ps(w, distance));
+			__m128 to_right = _mm_mul_ps(w, pan);
+			__m128 x = select(is_2D, _mm_mul_ps(to_right, rx), _mm_mul_ps(to_direction, tx));
+			__m128 y = select(is_2D, _mm_mul_ps(to_right, ry), _mm_mul_ps(to_direction, ty));
+			__m128 z = select(is_2D, _mm_mul_ps(to_right, rz), _mm_mul_ps(to_direction, tz));
+			l = select(ambisonic, w, l);
+			r = select(ambisonic, x, r);
+			_mm_storeu_ps(out_y + i, y);
+			_mm_storeu_ps(out_z + i, z);
+		}
+
+		_mm_storeu_ps(out_l + i, l);
+		_mm_storeu_ps(out_r + i, r);
+		if (audibility) {
+			__m128 loudest = _mm_max_ps(volume, _mm_loadu_ps(params.volume.target.data() + i));
+			_mm_storeu_ps(audibility + i, _mm_mul_ps(_mm_mul_ps(gv, loudest), att));
+		}
+	}
+#endif
+	for (; i < count; ++i) {
+		float pan = params.pan.value[i];
+		float att = 1.0f;
+		float gain = global_volume * params.volume.value[i];
+		if (any_ambisonic && params.ambisonic[i] != 0.0f) {
+			//B-format encoding:
+			glm::vec3 direction;
+			if (pan == pan) {
+				direction = listener_right * std::max(-1.0f, std::min(1.0f, pan));
+			} else {
+				glm::vec3 to = glm::vec3(params.x.value[i], params.y.value[i], params.z.value[i]) - listener_position;
+				float distance = glm::length(to);
+				direction = (distance == 0.0f ? glm::vec3(0.0f) : to / distance); //(sounds at the listener come from everywhere)
+				att = compute_attenuation(distance, params.half_volume_radius.value[i]);
+			}
+			out_l[i] = gain * att;
+			out_r[i] = gain * att * direction.x;
+			out_y[i] = gain * att * direction.y;
+			out_z[i] = gain * att * direction.z;
+		} else {
+			float l, r;
+			if (pan == pan) {
+				//2D panning
+				compute_pan_weights(pan, &l, &r);
+			} else {
+				//3D panning
+				glm::vec3 position = glm::vec3(params.x.value[i], params.y.value[i], params.z.value[i]);
+				float half_volume_radius = params.half_volume_radius.value[i];
+				compute_pan_from_listener_and_position(listener_position, listener_right, position, half_volume_radius, &l, &r);
+				att = compute_attenuation(glm::length(position - listener_position), half_volume_radius);
+			}
+			out_l[i] = l * gain;
+			out_r[i] = r * gain;
+		}
+		if (audibility) {
+			audibility[i] = global_volume * std::max(params.volume.value[i], params.volume.target[i]) * att;
+		}
+	}
+}
+
+//helper: decide which voices are mixed ("real") this block, and which only advance ("virtual"):
+// (uses params.audibility, so call compute_voice_gains() first)
+void choose_real_voices() {
+	voice_ranks.clear();
+	for (uint32_t active_index = 0; active_index < active_voices.size(); ++active_index) {
+		Voice &voice = voices[active_voices[active_index]];
+		voice.was_real = voice.real;
+		float audibility = params.audibility[active_index] * buses[voice.bus].audibility;
+		voice.real = (audibility > INAUDIBLE && !voice.leaving);
+		if (voice.real) {
+			//favor voices that are already real a bit, so that similar voices don't flip back and forth:
+			if (voice.was_real) audibility *= 1.25f;
+			voice_ranks.emplace_back(VoiceRank{voice.priority, audibility, active_index});
+		}
+	}
+
+	if (voice_ranks.size() <= max_real_voices) return;
+
+	//over budget -- keep only the highest priority (then most audible) voices:
+	std::nth_element(voice_ranks.begin(), voice_ranks.begin() + max_real_voices, voice_ranks.end(),
+		[](VoiceRank const &a, VoiceRank const &b) {
+			if (a.priority != b.priority) return a.priority > b.priority;
+			return a.audibility > b.audibility;
+		}
+	);
+	for (auto r = voice_ranks.begin() + max_real_voices; r != voice_ranks.end(); ++r) {
+		voices[active_voices[r->active_index]].real = false;
+	}
+}
+
+//helper: how far (in samples) the playhead moves in 'count' output samples as the rate ramps from 'rate_start' to 'rate_end':
+// (output sample s is read from position frac + s * rate_start + s * (s - 1) / 2 * rate_step, as in resample_run())
+double block_advance(float rate_start, float rate_end, uint32_t count) {
+	float rate_step = (rate_end - rate_start) / count;
+	return double(count) * rate_start + double(rate_step) * (0.5 * count * (count - 1.0));
+}
+
+//helper: move a sample voice's playhead forward by 'advance' (possibly fractional) samples:
+void advance_playhead(Voice &voice, double advance) {
+	uint32_t size = voice.sample->length;
+	if (size == 0) return;
+	double position = voice.frac + advance;
+	double whole = std::floor(position);
+	voice.frac = float(position - whole);
+	if (voice.frac >= 1.0f) { //(rounding)
+		voice.frac = 0.0f;
+		whole += 1.0;
+	}
+	if (voice.loop) {
+		voice.i = uint32_t((uint64_t(voice.i) + uint64_t(whole)) % size);
+	} else {
+		voice.i = uint32_t(std::min< uint64_t >(size, uint64_t(voice.i) + uint64_t(whole)));
+	}
+}
+
+//helper: advance a voice's playhead by 'count' output samples (usually a block) without mixing it:
+void advance_voice(Voice &voice, float rate_start, float rate_end, uint32_t count) {
+	if (voice.stream) {
+		voice.stream->read(nullptr, count);
+		return;
+	}
+	uint32_t size = voice.sample->length;
+	if (size == 0) return;
+	if (rate_start == 1.0f && rate_end == 1.0f && voice.frac == 0.0f) {
+		if (voice.loop) {
+			voice.i = uint32_t((uint64_t(voice.i) + count) % size);
+		} else {
+			voice.i = std::min(size, voice.i + count);
+		}
+	} else {
+		advance_playhead(voice, block_advance(rate_start, rate_end, count));
+	}
+}
+
+//helper: copy (decoding if needed) samples [begin, begin + count) of 'sample' into 'out',
+// wrapping around if 'loop' is set and padding with zeros past the end otherwise:
+void gather_samples(Sound::Sample const &sample, uint32_t begin, uint32_t count, bool loop, float *out) {
+	while (count > 0) {
+		if (begin >= sample.length) {
+			if (!loop || sample.length == 0) {
+				std::fill(out, out + count, 0.0f);
+				return;
+			}
+			begin %= sample.length;
+		}
+		uint32_t run = std::min(count, sample.length - begin);
+		sample.decode(begin, run, out);
+		begin += run;
+		out += run;
+		count -= run;
+	}
+}
+
+//helper: linearly interpolate 'count' samples from 'src', reading output sample s from position
+// frac + s * rate + s * (s - 1) / 2 * rate_step (that is, the rate changes by 'rate_step' every sample):
+void resample_run(float const *src, float frac, float rate, float rate_step, uint32_t count, float *out) {
+	float half_step = 0.5f * rate_step;
+	uint32_t s = 0;
+#if defined(SOUND_MIX_AVX) || defined(SOUND_MIX_SSE)
+	__m128 const lane = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+	for (; s + 4 <= count; s += 4) {
+		__m128 sv = _mm_add_ps(_mm_set1_ps(float(s)), lane);
+		__m128 pos = _mm_add_ps(_mm_set1_ps(frac), _mm_mul_ps(sv, _mm_set1_ps(rate)));
+		pos = _mm_add_ps(pos, _mm_mul_ps(_mm_mul_ps(sv, _mm_sub_ps(sv, _mm_set1_ps(1.0f))), _mm_set1_ps(half_step)));
+		__m128i index = _mm_cvttps_epi32(pos);
+		__m128 t = _mm_sub_ps(pos, _mm_cvtepi32_ps(index));
+		alignas(16) int32_t idx[4];
+		_mm_store_si128(reinterpret_cast< __m128i * >(idx), index);
+		__m128 a = _mm_set_ps(src[idx[3]], src[idx[2]], src[idx[1]], src[idx[0]]);
+		__m128 b = _mm_set_ps(src[idx[3] + 1], src[idx[2] + 1], src[idx[1] + 1], src[idx[0] + 1]);
+		_mm_storeu_ps(out + s, _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a))));
+	}
+#endif
+	for (; s < count; ++s) {
+		float sf = float(s);
+		float pos = frac + sf * rate + sf * (sf - 1.0f) * half_step;
+		int32_t index = int32_t(pos);
+		float t = pos - float(index);
+		out[s] = src[index] + t * (src[index + 1] - src[index]);
+	}
+}
+
+//helper: resample 'count' output samples (usually a block) of a sample voice playing at a rate other than 1.0 into 'out',
+// and advance its playhead ('gathered' is scratch space for the samples read; see MixChunk::rate_buffer):
+void resample_voice(Voice &voice, float rate_start, float rate_end, uint32_t count, std::vector< float > &gathered, float *out) {
+	double advance = block_advance(rate_start, rate_end, count);
+	//everything read is in [i, i + frac + advance + 1] (plus one more sample, in case of rounding):
+	uint32_t read = uint32_t(voice.frac + advance) + 3;
+	assert(read <= gathered.size());
+	gather_samples(*voice.sample, voice.i, read, voice.loop, gathered.data());
+	resample_run(gathered.data(), voice.frac, rate_start, (rate_end - rate_start) / count, count, out);
+	advance_playhead(voice, advance);
+}
+
+//helper: mix 'count' mono samples from 'src' into stereo 'dst',
+// with gains starting at 'pan' and changing by 'pan_step' every sample:
+void mix_run(float const *src, LR *dst, uint32_t count, LR pan, LR pan_step) {
+	uint32_t i = 0;
+
+#if defined(SOUND_MIX_AVX)
+	float *out = &dst[0].l;
+	//gains for samples 0-3 and 4-7 (as interleaved l,r pairs):
+	__m256 gain_a = _mm256_set_ps(
+		pan.r + 3.0f * pan_step.r, pan.l + 3.0f * pan_step.l,
+		pan.r + 2.0f * pan_step.r, pan.l + 2.0f * pan_step.l,
+		pan.r + 1.0f * pan_step.r, pan.l + 1.0f * pan_step.l,
+		pan.r, pan.l);
+	__m256 gain_step = _mm256_set_ps(
+		8.0f * pan_step.r, 8.0f * pan_step.l, 8.0f * pan_step.r, 8.0f * pan_step.l,
+		8.0f * pan_step.r, 8.0f * pan_step.l, 8.0f * pan_step.r, 8.0f * pan_step.l);
+	__m256 gain_b = _mm256_add_ps(gain_a, _mm256_mul_ps(gain_step, _mm256_set1_ps(0.5f)));
+	for (; i + 8 <= count; i += 8) {
+		__m256 s = _mm256_loadu_ps(src + i); //s0 .. s7
+		__m256 lo = _mm256_unpacklo_ps(s, s); //s0 s0 s1 s1 | s4 s4 s5 s5
+		__m256 hi = _mm256_unpackhi_ps(s, s); //s2 s2 s3 s3 | s6 s6 s7 s7
+		__m256 s_a = _mm256_permute2f128_ps(lo, hi, 0x20); //s0 s0 s1 s1 s2 s2 s3 s3
+		__m256 s_b = _mm256_permute2f128_ps(lo, hi, 0x31); //s4 s4 s5 s5 s6 s6 s7 s7
+		float *o = out + 2 * i;
+		_mm256_storeu_ps(o, _mm256_add_ps(_mm256_loadu_ps(o), _mm256_mul_ps(gain_a, s_a)));
+		_mm256_storeu_ps(o + 8, _mm256_add_ps(_mm256_loadu_ps(o + 8), _mm256_mul_ps(gain_b, s_b)));
+		gain_a = _mm256_add_ps(gain_a, gain_step);
+		gain_b = _mm256_add_ps(gain_b, gain_step);
+	}
+	pan.l += pan_step.l * i;
+	pan.r += pan_step.r * i;
+#elif defined(SOUND_MIX_SSE)
+	float *out = &dst[0].l;
+	//gains for samples 0-1, 2-3, 4-5, 6-7 (as interleaved l,r pairs):
+	__m128 gain_a = _mm_set_ps(pan.r + pan_step.r, pan.l + pan_step.l, pan.r, pan.l);
+	__m128 gain_quarter = _mm_set_ps(2.0f * pan_step.r, 2.0f * pan_step.l, 2.0f * pan_step.r, 2.0f * pan_step.l);
+	__m128 gain_b = _mm_add_ps(gain_a, gain_quarter);
+	__m128 gain_c = _mm_add_ps(gain_b, gain_quarter);
+	__m128 gain_d = _mm_add_ps(gain_c, gain_quarter);
+	__m128 gain_step = _mm_add_ps(_mm_add_ps(gain_quarter, gain_quarter), _mm_add_ps(gain_quarter, gain_quarter));
+	for (; i + 8 <= count; i += 8) {
+		__m128 s0 = _mm_loadu_ps(src + i); //s0 .. s3
+		__m128 s1 = _mm_loadu_ps(src + i + 4); //s4 .. s7
+		float *o = out + 2 * i;
+		_mm_storeu_ps(o, _mm_add_ps(_mm_loadu_ps(o), _mm_mul_ps(gain_a, _mm_unpacklo_ps(s0, s0))));
+		_mm_storeu_ps(o + 4, _mm_add_ps(_mm_loadu_ps(o + 4), _mm_mul_ps(gain_b, _mm_unpackhi_ps(s0, s0))));
+		_mm_storeu_ps(o + 8, _mm_add_ps(_mm_loadu_ps(o + 8), _mm_mul_ps(gain_c, _mm_unpacklo_ps(s1, s1))));
+		_mm_storeu_ps(o + 12, _mm_add_ps(_mm_loadu_ps(o + 12), _mm_mul_ps(gain_d, _mm_unpackhi_ps(s1, s1))));
+		gain_a = _mm_add_ps(gain_a, gain_step);
+		gain_b = _mm_add_ps(gain_b, gain_step);
+		gain_c = _mm_add_ps(gain_c, gain_step);
+		gain_d = _mm_add_ps(gain_d, gain_step);
+	}
+	pan.l += pan_step.l * i;
+	pan.r += pan_step.r * i;
+#endif
+
+	//scalar fallback (and leftover samples):
+	for (; i < count; ++i) {
+		dst[i].l += pan.l * src[i];
+		dst[i].r += pan.r * src[i];
+		pan.l += pan_step.l;
+		pan.r += pan_step.r;
+	}
+}
+
+//helper: zero a bus buffer (both runs of an ambisonic bus -- see BusState::ambisonic):
+void zero_bus(LR *buffer, bool ambisonic) {
+	for (uint32_t s = 0; s < mix_samples; ++s) {
+		buffer[s].l = 0.0f;
+		buffer[s].r = 0.0f;
+	}
+	if (ambisonic) zero_bus(buffer + MAX_MIX_SAMPLES, false);
+}
+
+//helper: add 'src' into 'dst' (both mix_samples frames), with gain ramping from 'start' to 'end':
+void mix_bus(LR const *src, LR *dst, float start, float end) {
+	if (start == 0.0f && end == 0.0f) return;
+	float gain = start;
+	float step = (end - start) / mix_samples;
+	for (uint32_t s = 0; s < mix_samples; ++s) {
+		dst[s].l += gain * src[s].l;
+		dst[s].r += gain * src[s].r;
+		gain += step;
+	}
+}
+
+//helper: scale 'buffer' (mix_samples frames) by a gain ramping from 'start' to 'end':
+void scale_bus(LR *buffer, float start, float end) {
+	if (start == 1.0f && end == 1.0f) return;
+	if (start == end) {
+		pcm_gain(&buffer[0].l, 2 * mix_samples, start);
+		return;
+	}
+	float gain = start;
+	float step = (end - start) / mix_samples;
+	for (uint32_t s = 0; s < mix_samples; ++s) {
+		buffer[s].l *= gain;
+		buffer[s].r *= gain;
+		gain += step;
+	}
+}
+
+//helper: turn B-format audio (see BusState::ambisonic) to face the listener and decode it to stereo, in place in its (W, X) run:
+// the listener's right vector ramps from 'start_right' to 'end_right' over the block,
+// and the decoder is a pair of virtual cardioid microphones pointing left and right
+// (scaled so that sounds straight ahead come out the same as they would on a stereo bus)
+void decode_ambisonic_bus(LR *buffer, glm::vec3 const &start_right, glm::vec3 const &end_right) {
+	LR const *yz = buffer + MAX_MIX_SAMPLES;
+	//the only direction stereo needs is "right", so turning the sound field is just a dot product with it:
+	glm::vec3 right = start_right * SQRT_HALF;
+	glm::vec3 right_step = (end_right - start_right) * (SQRT_HALF / mix_samples);
+	for (uint32_t s = 0; s < mix_samples; ++s) {
+		float w = SQRT_HALF * buffer[s].l;
+		float side = right.x * buffer[s].r + right.y * yz[s].l + right.z * yz[s].r;
+		buffer[s].l = w - side;
+		buffer[s].r = w + side;
+		right += right_step;
+	}
+}
+
+//helper: mix (or just advance) the voice at 'active_index' for a block, into 'chunk''s buses;
+// returns true if the voice has finished (but leaves returning it to the pool to the caller):
+bool mix_voice(uint32_t active_index, MixChunk &chunk) {
+	Voice &voice = voices[active_voices[active_index]];
+	LR *mix = chunk.bus_mix(voice.bus);
+
+	//real voices are mixed, as are voices that just became virtual (so they can fade out):
+	// (so at most 2 * max_real_voices are mixed in any block)
+	bool mixing = voice.real || voice.was_real;
+
+	//voices playing samples that are still loading (see Sample::load_async) wait silently for them:
+	bool waiting = (!voice.stream && voice.sample->loading.load(std::memory_order_acquire));
+
+	float rate_start = params.start_rate[active_index];
+	float rate_end = params.rate.value[active_index];
+
+	//voices scheduled with play_at() (etc.) also wait, then start partway through a block, 'offset' samples in:
+	uint32_t offset = 0;
+	if (voice.start > block_clock) {
+		if (voice.start - block_clock >= mix_samples) waiting = true;
+		else offset = uint32_t(voice.start - block_clock);
+	}
+	uint32_t frames = mix_samples - offset; //(samples of the block the voice plays)
+	mix += offset;
+	rate_start += (rate_end - rate_start) * offset / mix_samples; //(rate at the first sample played)
+
+	if (waiting) {
+		//(nothing to mix or advance yet)
+	} else if (!mixing) {
+		advance_voice(voice, rate_start, rate_end, frames);
+	} else {
+		++chunk.voices_mixed;
+
+		//panning/volume at start and end of the mix period:
+		LR start_pan = LR{params.start_l[active_index], params.start_r[active_index]};
+		LR end_pan = LR{params.end_l[active_index], params.end_r[active_index]};
+
+		//fade in voices that were virtual; fade out voices that just became virtual:
+		if (!voice.was_real && !voice.fresh) start_pan = LR{0.0f, 0.0f};
+		if (!voice.real) end_pan = LR{0.0f, 0.0f};
+
+		//figure out a step to add at each sample so that pan will move smoothly from start to end:
+		LR pan_step;
+		pan_step.l = (end_pan.l - start_pan.l) / mix_samples;
+		pan_step.r = (end_pan.r - start_pan.r) / mix_samples;
+
+		//(voices starting partway through the block start partway along the ramp)
+		start_pan.l += pan_step.l * offset;
+		start_pan.r += pan_step.r * offset;
+
+		//voices on ambisonic buses also mix their Y and Z channels (see BusState::ambisonic):
+		bool ambisonic = buses[voice.bus].ambisonic;
+		LR start_yz = LR{0.0f, 0.0f};
+		LR yz_step = LR{0.0f, 0.0f};
+		if (ambisonic) {
+			start_yz = LR{params.start_y_gain[active_index], params.start_z_gain[active_index]};
+			LR end_yz = LR{params.end_y_gain[active_index], params.end_z_gain[active_index]};
+			if (!voice.was_real && !voice.fresh) start_yz = LR{0.0f, 0.0f};
+			if (!voice.real) end_yz = LR{0.0f, 0.0f};
+			yz_step.l = (end_yz.l - start_yz.l) / mix_samples;
+			yz_step.r = (end_yz.r - start_yz.r) / mix_samples;
+			start_yz.l += yz_step.l * offset;
+			start_yz.r += yz_step.r * offset;
+		}
+
+		//mix 'count' samples from 'src' into the bus, starting 'at' samples into the voice's part of the block:
+		auto mix_from = [&](float const *src, uint32_t at, uint32_t count) {
+			LR pan;
+			pan.l = start_pan.l + pan_step.l * at;
+			pan.r = start_pan.r + pan_step.r * at;
+			mix_run(src, mix + at, count, pan, pan_step);
+			if (ambisonic) {
+				LR yz;
+				yz.l = start_yz.l + yz_step.l * at;
+				yz.r = start_yz.r + yz_step.r * at;
+				mix_run(src, mix + MAX_MIX_SAMPLES + at, count, yz, yz_step);
+			}
+		};
+
+		if (voice.stream) {
+			//streams are read into a temporary buffer and mixed from there:
+			uint32_t count = voice.stream->read(chunk.decode_buffer.data(), frames);
+			mix_from(chunk.decode_buffer.data(), 0, count);
+		} else if (rate_start != 1.0f || rate_end != 1.0f || voice.frac != 0.0f) {
+			//samples playing at other rates are resampled into a temporary buffer and mixed from there:
+			resample_voice(voice, rate_start, rate_end, frames, chunk.rate_buffer, chunk.decode_buffer.data());
+			mix_from(chunk.decode_buffer.data(), 0, frames);
+		} else {
+			Sound::Sample const &sample = *voice.sample;
+			//mix contiguous runs of sample data, splitting the block wherever a looping sample wraps around:
+			uint32_t mixed = 0;
+			while (mixed < frames && sample.length != 0) {
+				assert(voice.i < sample.length);
+				uint32_t run = std::min(frames - mixed, sample.length - voice.i);
+
+				//float samples are mixed in place; compressed samples are decoded first:
+				float const *src;
+				if (sample.format == Sound::Sample::Float32) {
+					src = sample.floats() + voice.i;
+				} else {
+					sample.decode(voice.i, run, chunk.decode_buffer.data());
+					src = chunk.decode_buffer.data();
+				}
+				mix_from(src, mixed, run);
+
+				mixed += run;
+				voice.i += run;
+				if (voice.i == sample.length) {
+					if (voice.loop) {
+						voice.i = 0;
+					} else {
+						break;
+					}
+				}
+			}
+		}
+	}
+	if (!waiting) voice.fresh = false; //(so a waiting voice starts without a fade-in)
+
+	bool ended;
+	if (waiting) {
+		ended = false;
+	} else if (voice.stream) {
+		ended = voice.stream->at_end();
+	} else {
+		ended = (voice.sample->length == 0 || voice.i >= voice.sample->length);
+	}
+
+	return ended || (voice.stopping && params.volume.value[active_index] == 0.0f);
+}
+
+//helper: mix the voices in chunk 'c' (see MixChunk):
+void mix_chunk(uint32_t c) {
+	MixChunk &chunk = mix_chunks[c];
+	chunk.voices_mixed = 0;
+	if (!chunk.buffer.empty()) {
+		for (uint32_t b = 0; b < buses.size(); ++b) {
+			zero_bus(chunk.bus_mix(b), buses[b].ambisonic);
+		}
+	}
+	uint32_t chunks = uint32_t(mix_chunks.size());
+	for (uint32_t active_index = c; active_index < active_voices.size(); active_index += chunks) {
+		voice_finished[active_index] = mix_voice(active_index, chunk);
+	}
+}
+
+//helper: claim and mix chunks until none are left (called by the audio thread and the mixer workers):
+void mix_claimed_chunks() {
+	uint32_t chunks = uint32_t(mix_chunks.size());
+	while (true) {
+		uint32_t c = next_chunk.load(std::memory_order_acquire);
+		while (c < chunks && !next_chunk.compare_exchange_weak(c, c + 1, std::memory_order_acq_rel)) {
+		}
+		if (c >= chunks) return;
+		mix_chunk(c);
+		chunks_done.fetch_add(1, std::memory_order_release);
+	}
+}
+
+//helper: the core mixer worker 'index' (1, 2, ...) is pinned to -- worker w gets core w, or, if the audio thread is pinned,
+// the next core that isn't the audio thread's (see Settings::audio_thread_core):
+uint32_t worker_core(uint32_t index) {
+	uint32_t cores = std::max(1U, std::thread::hardware_concurrency());
+	if (audio_thread_core == -1U || cores == 1) return index;
+	uint32_t core = (index - 1) % (cores - 1);
+	return (core >= audio_thread_core % cores ? core + 1 : core);
+}
+
+//helper: keep the calling thread on one core (where supported), so mixer workers don't migrate between blocks:
+void pin_thread(uint32_t core) {
+	uint32_t cores = std::max(1U, std::thread::hardware_concurrency());
+	core %= cores;
+#if defined(_WIN32)
+	SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << core);
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+	(void)core; //(macOS doesn't allow pinning threads)
+#endif
+}
+
+//helper: ask for real-time scheduling for the calling thread (warns once if that isn't allowed):
+void request_realtime_priority() {
+	bool granted = true;
+#if defined(_WIN32)
+	granted = SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+#elif defined(__APPLE__)
+	//time-constraint policy, as used by CoreAudio's own threads -- expect to run for (at most) half of each block:
+	mach_timebase_info_data_t timebase;
+	mach_timebase_info(&timebase);
+	double ticks_per_second = 1.0e9 * double(timebase.denom) / double(timebase.numer);
+	thread_time_constraint_policy_data_t policy;
+	policy.period = uint32_t(ticks_per_second * ramp_step);
+	policy.computation = policy.period / 2;
+	policy.constraint = policy.period;
+	policy.preemptible = 1;
+	granted = (thread_policy_set(mach_thread_self(), THREAD_TIME_CONSTRAINT_POLICY, reinterpret_cast< thread_policy_t >(&policy), THREAD_TIME_CONSTRAINT_POLICY_COUNT) == KERN_SUCCESS);
+#else
+	sched_param param;
+	param.sched_priority = sched_get_priority_min(SCHED_FIFO) + 10; //(above most other real-time threads, but below the system's own)
+	granted = (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0);
+#endif
+	if (!granted) {
+		static std::atomic< bool > warned{false};
+		if (!warned.exchange(true)) {
+			std::cerr << "WARNING: real-time scheduling priority for audio was denied; the audio thread will run at normal priority." << std::endl;
+		}
+	}
+}
+
+//helper: lock a buffer into memory, remembering it so unlock_buffers() can undo it:
+void lock_buffer(void const *data, size_t bytes) {
+	if (data == nullptr || bytes == 0) return;
+#if defined(_WIN32)
+	bool locked = VirtualLock(const_cast< void * >(data), bytes);
+#else
+	bool locked = (mlock(data, bytes) == 0);
+#endif
+	if (!locked) {
+		static bool warned = false;
+		if (!warned) {
+			std::cerr << "WARNING: failed to lock audio buffers into memory (the system's locked memory limit may be too low); they may be paged out." << std::endl;
+			warned = true;
+		}
+		return;
+	}
+	locked_buffers.emplace_back(data, bytes);
+}
+
+//helper: lock everything the mixer touches while running into memory (only call when the audio callback can't be running):
+void lock_buffers() {
+	assert(locked_buffers.empty());
+	auto lock_vector = [](auto const &vector) {
+		lock_buffer(vector.data(), vector.capacity() * sizeof(vector[0]));
+	};
+	lock_vector(voices);
+	lock_buffer(generations.get(), voices.size() * sizeof(generations[0]));
+	lock_vector(active_voices);
+	lock_vector(voice_ranks);
+	lock_vector(voice_finished);
+	lock_vector(far_voices);
+	lock_vector(far_cells);
+	lock_vector(far_ends);
+	params.for_each_array([&lock_vector](std::vector< float > &array) {
+		lock_vector(array);
+	});
+	for (auto const &bus : buses) {
+		lock_vector(bus.buffer);
+		lock_vector(bus.effects);
+	}
+	for (auto const &chunk : mix_chunks) {
+		lock_vector(chunk.buffer);
+		lock_vector(chunk.decode_buffer);
+		lock_vector(chunk.rate_buffer);
+	}
+	lock_vector(render_buffer);
+	lock_buffer(commands.storage(), commands.storage_bytes());
+	lock_buffer(free_voices.storage(), free_voices.storage_bytes());
+	lock_buffer(block_stats.storage(), block_stats.storage_bytes());
+	lock_buffer(retired_effects.storage(), retired_effects.storage_bytes());
+	lock_buffer(captured.storage(), captured.storage_bytes());
+}
+
+//helper: undo lock_buffers() (only call when the audio callback can't be running):
+void unlock_buffers() {
+	for (auto const &[data, bytes] : locked_buffers) {
+	#if defined(_WIN32)
+		VirtualUnlock(const_cast< void * >(data), bytes);
+	#else
+		munlock(data, bytes);
+	#endif
+	}
+	locked_buffers.clear();
+}
+
+#if defined(_WIN32)
+WakeSemaphore::WakeSemaphore() : handle(CreateSemaphoreA(nullptr, 0, LONG_MAX, nullptr)) {
+	if (!handle) throw std::runtime_error("Failed to create a semaphore for a mixer worker.");
+}
+WakeSemaphore::~WakeSemaphore() {
+	CloseHandle(handle);
+}
+void WakeSemaphore::post() {
+	ReleaseSemaphore(handle, 1, nullptr);
+}
+void WakeSemaphore::wait() {
+	WaitForSingleObject(handle, INFINITE);
+}
+#elif defined(__APPLE__)
+WakeSemaphore::WakeSemaphore() {
+	if (semaphore_create(mach_task_self(), &semaphore, SYNC_POLICY_FIFO, 0) != KERN_SUCCESS) {
+		throw std::runtime_error("Failed to create a semaphore for a mixer worker.");
+	}
+}
+WakeSemaphore::~WakeSemaphore() {
+	semaphore_destroy(mach_task_self(), semaphore);
+}
+void WakeSemaphore::post() {
+	semaphore_signal(semaphore);
+}
+void WakeSemaphore::wait() {
+	while (semaphore_wait(semaphore) == KERN_ABORTED) { }
+}
+#else
+WakeSemaphore::WakeSemaphore() {
+	if (sem_init(&semaphore, 0, 0) != 0) throw std::runtime_error("Failed to create a semaphore for a mixer worker.");
+}
+WakeSemaphore::~WakeSemaphore() {
+	sem_destroy(&semaphore);
+}
+void WakeSemaphore::post() {
+	sem_post(&semaphore);
+}
+void WakeSemaphore::wait() {
+	while (sem_wait(&semaphore) != 0 && errno == EINTR) { }
+}
+#endif
+
+//mixer worker 'index' (1, 2, ...) waits for blocks to start, then helps mix chunks:
+// (a late wake-up -- e.g., for a block the audio thread already finished -- just finds no chunks left to claim)
+void mix_worker(uint32_t index) {
+	pin_thread(worker_core(index));
+	if (realtime) request_realtime_priority();
+	WakeSemaphore &wake = *mix_workers_wake[index - 1];
+	while (true) {
+		wake.wait();
+		if (mix_workers_quit.load(std::memory_order_acquire)) return;
+		NoAllocations no_allocations;
+		mix_claimed_chunks();
+	}
+}
+
+void start_mix_workers() {
+	assert(mix_workers.empty());
+	mix_workers_quit.store(false, std::memory_order_relaxed);
+	for (uint32_t w = 1; w < mix_chunks.size(); ++w) {
+		mix_workers_wake.emplace_back(new WakeSemaphore);
+	}
+	for (uint32_t w = 1; w < mix_chunks.size(); ++w) {
+		mix_workers.emplace_back(mix_worker, w);
 	}
 }
 
+void stop_mix_workers() {
+	mix_workers_quit.store(true, std::memory_order_release);
+	for (auto &wake : mix_workers_wake) {
+		wake->post();
+	}
+	for (auto &worker : mix_workers) {
+		worker.join();
+	}
+	mix_workers.clear();
+	mix_workers_wake.clear();
+}
 
 //The audio callback -- invoked by SDL when it needs more sound to play:
 void mix_audio(void *, Uint8 *buffer_, int len) {
 	assert(buffer_); //should always have some audio buffer
 
-	struct LR {
-		float l;
-		float r;
-	};
-	static_assert(sizeof(LR) == 8, "Sample is packed");
-	assert(len == MIX_SAMPLES * sizeof(LR)); //should always have the expected number of samples
+	assert(size_t(len) == mix_samples * sizeof(LR)); //should always have the expected number of samples
 	LR *buffer = reinterpret_cast< LR * >(buffer_);
 
-	//zero the output buffer:
-	for (uint32_t s = 0; s < MIX_SAMPLES; ++s) {
-		buffer[s].l = 0.0f;
-		buffer[s].r = 0.0f;
+	//on the audio thread's first block, ask for real-time priority (and move it to its core):
+	if (!offline && !audio_thread_configured) {
+		if (realtime) request_realtime_priority();
+		if (audio_thread_core != -1U) pin_thread(audio_thread_core);
+		audio_thread_configured = true;
+	}
+
+	NoAllocations no_allocations; //(see SOUND_TRAP_AUDIO_ALLOCATIONS)
+
+	auto before = std::chrono::steady_clock::now();
+
+	//apply any commands sent since the last block:
+	drain_commands();
+
+	//skip voices too far away to hear (and bring back ones that are in range again):
+	uint32_t voices_finished = update_far_voices(Sound::listener.position.value);
+
+	//zero the bus buffers (master mixes straight into the output buffer):
+	for (auto &bus : buses) {
+		bus.mix = (bus.parent == -1U ? buffer : bus.buffer.data());
+		zero_bus(bus.mix, bus.ambisonic);
+	}
+
+	//how loud can each bus get? (parents come after children, so go backward):
+	for (uint32_t b = uint32_t(buses.size()) - 1; b < buses.size(); --b) {
+		BusState &bus = buses[b];
+		bus.audibility = std::max(bus.volume.value, bus.volume.target);
+		if (bus.parent != -1U) bus.audibility *= buses[bus.parent].audibility;
 	}
 
 	//update global values:
@@ -341,98 +2900,147 @@ void mix_audio(void *, Uint8 *buffer_, int len) {
 	glm::vec3 end_position =  Sound::listener.position.value;
 	glm::vec3 end_right =  Sound::listener.right.value;
 
-	//add audio from each playing sample into the buffer:
-	for (auto si = playing_samples.begin(); si != playing_samples.end(); /* later */) {
-		Sound::PlayingSample &playing_sample = **si; //much more convenient than writing ** everywhere.
-
-		//Figure out sample panning/volume at start...
-		LR start_pan;
-		if (!(playing_sample.pan.value == playing_sample.pan.value)) {
-			//3D panning
-			compute_pan_from_listener_and_position(
-				start_position, start_right,
-				playing_sample.position.value,
-				playing_sample.half_volume_radius.value,
-				&start_pan.l, &start_pan.r);
-
-			step_position_ramp(playing_sample.position);
-			step_value_ramp(playing_sample.half_volume_radius);
+	//parameter stage -- gains at the start of the block for every voice (and how loud each is):
+	compute_voice_gains(start_position, start_right, start_volume, params.start_l.data(), params.start_r.data(), params.start_y_gain.data(), params.start_z_gain.data(), params.audibility.data());
+
+	//decide which voices get mixed (the rest are virtual, and only advance):
+	choose_real_voices();
+
+	//...step every voice's ramps, and compute gains at the end of the block:
+	step_value_ramps(params.volume);
+	step_value_ramps(params.pan);
+	step_value_ramps(params.x);
+	step_value_ramps(params.y);
+	step_value_ramps(params.z);
+	step_value_ramps(params.half_volume_radius);
+	params.start_rate = params.rate.value; //(capacity is reserved, so this doesn't allocate)
+	step_value_ramps(params.rate);
+	compute_voice_gains(end_position, end_right, end_volume, params.end_l.data(), params.end_r.data(), params.end_y_gain.data(), params.end_z_gain.data(), nullptr);
+
+	//mix every playing voice into its bus, a chunk at a time (see MixChunk):
+	voice_finished.assign(active_voices.size(), 0); //(capacity is reserved, so this doesn't allocate)
+	chunks_done.store(0, std::memory_order_relaxed);
+	next_chunk.store(0, std::memory_order_release);
+	if (!mix_workers.empty() && active_voices.size() >= WORKER_MIN_VOICES) {
+		for (auto &wake : mix_workers_wake) {
+			wake->post();
+		}
+	}
+	//the audio thread doesn't wait for workers to wake up -- it claims and mixes every chunk they haven't started:
+	mix_claimed_chunks();
+	//...so it only waits for chunks a worker is partway through (which can't be taken over, since mixing a chunk advances its voices):
+	// spin briefly, then yield the core (in case the worker was preempted by something on this core)
+	for (uint32_t spin = 0; chunks_done.load(std::memory_order_acquire) < mix_chunks.size(); ++spin) {
+		if (spin < WORKER_SPINS) {
+		#if defined(SOUND_MIX_AVX) || defined(SOUND_MIX_SSE)
+			_mm_pause();
+		#endif
 		} else {
-			//2D panning
-			compute_pan_weights(playing_sample.pan.value, &start_pan.l, &start_pan.r);
+			std::this_thread::yield();
+		}
+	}
 
-			step_value_ramp(playing_sample.pan);
+	//add the other chunks' buses to the real buses, always in the same order (so the result is deterministic):
+	for (uint32_t c = 1; c < mix_chunks.size(); ++c) {
+		for (uint32_t b = 0; b < buses.size(); ++b) {
+			mix_bus(mix_chunks[c].bus_mix(b), buses[b].mix, 1.0f, 1.0f);
+			if (buses[b].ambisonic) mix_bus(mix_chunks[c].bus_mix(b) + MAX_MIX_SAMPLES, buses[b].mix + MAX_MIX_SAMPLES, 1.0f, 1.0f);
 		}
-		start_pan.l *= start_volume * playing_sample.volume.value;
-		start_pan.r *= start_volume * playing_sample.volume.value;
+	}
 
-		step_value_ramp(playing_sample.volume);
+	uint32_t voices_mixed = 0;
+	for (auto const &chunk : mix_chunks) {
+		voices_mixed += chunk.voices_mixed;
+	}
 
-		//..and end of the mix period:
-		LR end_pan;
-		if (!(playing_sample.pan.value == playing_sample.pan.value)) {
-			//3D panning
-			compute_pan_from_listener_and_position(
-				end_position, end_right,
-				playing_sample.position.value,
-				playing_sample.half_volume_radius.value,
-				&end_pan.l, &end_pan.r);
-		} else {
-			//2D panning
-			compute_pan_weights(playing_sample.pan.value, &end_pan.l, &end_pan.r);
+	//return finished voices to the pool:
+	// (going backward, so the voice that finish_voice() moves into 'active_index' has already been checked)
+	for (uint32_t active_index = uint32_t(active_voices.size()) - 1; active_index < active_voices.size(); --active_index) {
+		if (voice_finished[active_index]) {
+			finish_voice(active_index);
+			++voices_finished;
 		}
+	}
 
-		end_pan.l *= end_volume * playing_sample.volume.value;
-		end_pan.r *= end_volume * playing_sample.volume.value;
+	//run each bus's effects and mix it into its parent:
+	// (children come before parents, so each bus is complete by the time it is processed)
+	for (auto &bus : buses) {
+		if (bus.ambisonic) decode_ambisonic_bus(bus.mix, start_right, end_right);
+		for (Sound::Effect *effect : bus.effects) {
+			effect->process(&bus.mix[0].l, mix_samples);
+		}
+		float start = bus.volume.value;
+		step_value_ramp(bus.volume);
+		float end = bus.volume.value;
+		if (bus.parent != -1U) {
+			mix_bus(bus.mix, buses[bus.parent].mix, start, end);
+		} else {
+			scale_bus(bus.mix, start, end);
+		}
+	}
 
-		//figure out a step to add at each sample so that pan will move smoothly from start to end:
-		LR pan = start_pan;
-		LR pan_step;
-		pan_step.l = (end_pan.l - start_pan.l) / MIX_SAMPLES;
-		pan_step.r = (end_pan.r - start_pan.r) / MIX_SAMPLES;
+	voices_mixed_last_block = voices_mixed;
+
+	//advance the audio clock:
+	block_clock += mix_samples;
+	audio_clock_samples.store(block_clock, std::memory_order_release);
+
+	//record stats:
+	Sound::BlockStats block;
+	block.block = blocks_mixed++;
+	block.frames = mix_samples;
+	block.voices_playing = uint32_t(active_voices.size() + far_voices.size());
+	block.voices_far = uint32_t(far_voices.size());
+	block.voices_mixed = voices_mixed;
+	block.voices_finished = voices_finished;
+	for (uint32_t s = 0; s < mix_samples; ++s) {
+		block.peak = std::max(block.peak, std::max(std::abs(buffer[s].l), std::abs(buffer[s].r)));
+	}
+	block.mix_seconds = std::chrono::duration< float >(std::chrono::steady_clock::now() - before).count();
+	block.missed_deadline = (block.mix_seconds > float(mix_samples) / float(AUDIO_RATE));
 
-		assert(playing_sample.i < playing_sample.data.size());
+	stats_blocks.fetch_add(1, std::memory_order_relaxed);
+	if (block.missed_deadline) stats_missed_deadlines.fetch_add(1, std::memory_order_relaxed);
+	if (!block_stats.push(block)) stats_dropped.fetch_add(1, std::memory_order_relaxed);
+}
 
-		for (uint32_t i = 0; i < MIX_SAMPLES; ++i) {
-			//mix one sample based on current pan values:
-			buffer[i].l += pan.l * playing_sample.data[playing_sample.i];
-			buffer[i].r += pan.r * playing_sample.data[playing_sample.i];
+//------------------------ allocation trap (debug) --------------------------------
+//(see SOUND_TRAP_AUDIO_ALLOCATIONS, above)
 
-			//update position in sample:
-			playing_sample.i += 1;
-			if (playing_sample.i == playing_sample.data.size()) {
-				if (playing_sample.loop) {
-					playing_sample.i = 0;
-				} else {
-					break;
-				}
-			}
+#ifdef SOUND_TRAP_AUDIO_ALLOCATIONS
+//helper: abort if called while mixing:
+static void trap_audio_allocation(char const *what) {
+	if (in_mixer) {
+		in_mixer = false; //(so reporting can't re-trigger the trap)
+		std::fputs(what, stderr);
+		std::abort();
+	}
+}
 
-			//update pan values:
-			pan.l += pan_step.l;
-			pan.r += pan_step.r;
-		}
+void *operator new(std::size_t size) {
+	trap_audio_allocation("Memory allocated on the audio thread while mixing.\n");
+	if (void *ptr = std::malloc(size ? size : 1)) return ptr;
+	throw std::bad_alloc();
+}
 
-		if (playing_sample.i >= playing_sample.data.size()
-		 || (playing_sample.stopping && playing_sample.volume.value == 0.0f)) { //sample has finished
-		 	playing_sample.stopped = true;
-			//erase from list:
-			auto old = si;
-			++si;
-			playing_samples.erase(old);
-		} else {
-			++si;
-		}
-	}
+void *operator new[](std::size_t size) {
+	return operator new(size);
+}
 
-	/*//DEBUG: report output power:
-	float max_power = 0.0f;
-	for (uint32_t s = 0; s < MIX_SAMPLES; ++s) {
-		max_power = std::max(max_power, (buffer[s].l * buffer[s].l + buffer[s].r * buffer[s].r));
-	}
-	std::cout << "Max Power: " << std::sqrt(max_power) << "; playing samples: " << playing_samples.size() << std::endl; //DEBUG
-	*/
+void operator delete(void *ptr) noexcept {
+	if (ptr) trap_audio_allocation("Memory freed on the audio thread while mixing.\n");
+	std::free(ptr);
+}
 
+void operator delete[](void *ptr) noexcept {
+	operator delete(ptr);
 }
 
+void operator delete(void *ptr, std::size_t) noexcept {
+	operator delete(ptr);
+}
 
+void operator delete[](void *ptr, std::size_t) noexcept {
+	operator delete(ptr);
+}
+#endif
@@ -3,9 +3,16 @@
 #include <glm/glm.hpp>
 
 #include <memory>
+#include <future>
+#include <atomic>
 #include <vector>
+#include <deque>
+#include <map>
 #include <string>
+#include <utility>
 #include <cmath>
+#include <limits>
+#include <cstdint>
 
 //Game audio system. Simplified from f18-base3.
 //Uses 48kHz sampling rate.
@@ -14,15 +21,125 @@ namespace Sound {
 
 //Sample objects hold mono (one-channel) audio.
 struct Sample {
+	//How sample data is stored in memory:
+	// (compressed formats are decoded by the mixer as it plays them)
+	enum Format : uint8_t {
+		Float32, //32-bit float (4 bytes/sample)
+		Int16, //16-bit integer (2 bytes/sample)
+		ADPCM, //IMA-ADPCM (about 0.5 bytes/sample; some loss of quality)
+	};
+
 	//Load from a '.wav' or '.opus' file.
 	//  will warn and convert if sound is not already 48kHz mono:
-	Sample(std::string const &filename);
+	Sample(std::string const &filename, Format format = Float32);
 	
 	//Directly supply an audio buffer:
-	Sample(std::vector< float > const &data);
+	Sample(std::vector< float > const &data, Format format = Float32);
+
+	//Empty sample (plays as silence); fill it with load_async():
+	Sample() = default;
+
+	//Load from a '.wav' or '.opus' file on a background thread (see WorkerPool.hpp), returning right away:
+	// while 'loading', voices playing the sample are silent (they start once it is loaded);
+	// the returned future is ready when loading is done (and its get() rethrows any loading error -- see add_load_future() in Load.hpp).
+	//NOTE: don't read, copy, or destroy the sample while it is loading.
+	std::shared_future< void > load_async(std::string const &filename, Format format = Float32);
+	std::atomic< bool > loading{false};
+
+	//(Samples are copyable, just not while loading)
+	Sample(Sample const &);
+	Sample &operator=(Sample const &);
+
+	//sample data is 48kHz, mono, stored in one of these, depending on format:
+	Format format = Float32;
+	std::vector< float > data; //Float32 samples
+	std::vector< int16_t > data16; //Int16 samples
+	std::vector< uint8_t > adpcm; //ADPCM blocks (see ima_adpcm.hpp)
+	std::shared_ptr< float const > mapped; //Float32 samples memory-mapped from the PCM cache (used instead of 'data' if set; see pcm_cache.hpp)
+	uint32_t length = 0; //length in samples (for all formats)
+
+	//Float32 samples, wherever they are stored:
+	float const *floats() const { return mapped ? mapped.get() : data.data(); }
+
+	//memory used by sample data:
+	size_t resident_bytes() const;
+
+	//playback bookkeeping (used by SampleCache to decide what it can free):
+	mutable std::atomic< uint32_t > voices{0}; //voices playing the sample (from Sound::play*() until the mixer finishes them)
+	mutable uint64_t last_played = 0; //when the sample was last played (a count of Sound::play*() calls; game thread only)
+
+	//decode samples [begin, begin + count) as floating point into 'out':
+	void decode(uint32_t begin, uint32_t count, float *out) const;
+
+	//(used by constructors) load from a file / store 'data' in 'format':
+	void load(std::string const &filename, Format format);
+	void compress(Format format);
+};
+
+//Stream objects play long sounds (e.g., music) without decoding them up front:
+// a background thread decodes a little ahead of the mixer into a small ring buffer.
+//NOTE: a stream has just one playback position, so only play it on one voice at a time;
+// and (like Samples) keep it alive while it is playing.
+struct Stream {
+	//Open an '.opus' file; throws on error:
+	Stream(std::string const &filename);
+	~Stream();
+
+	Stream(Stream const &) = delete;
+	Stream &operator=(Stream const &) = delete;
+
+	//jump to a time (in seconds) in the stream:
+	// (playing a stream continues from wherever it left off -- or from the start, once it has played to its end -- so use seek(0.0f) to restart it)
+	void seek(float time);
+
+	//internals:
+	struct Decoder;
+	std::unique_ptr< Decoder > decoder;
+};
+
+//SampleCache shares samples loaded from files, so each file is decoded (and stored) just once,
+// and keeps the memory used by samples under a budget by freeing samples that aren't in use:
+struct SampleCache {
+	//'budget' is how much memory (in bytes, as per Sample::resident_bytes()) the cache's samples should use:
+	SampleCache(size_t budget = std::numeric_limits< size_t >::max());
+
+	//Handles are reference-counted; a sample is never freed while it has handles (so it is safe to play):
+	using Handle = std::shared_ptr< Sample const >;
+
+	//get the sample for a '.wav' or '.opus' file, loading it (again, if it was freed) if needed; throws on error:
+	// (files are looked up by canonical path, so different spellings of a path -- e.g., from data_path() -- share a sample)
+	Handle get(std::string const &filename, Sample::Format format = Sample::Float32);
+
+	//free samples with no handles that aren't playing (least-recently-played first) until under budget:
+	// (get() does this after loading; call it after dropping handles -- e.g., when changing levels -- to free memory right away)
+	void trim();
 
-	//sample data is stored as 48kHz, mono, floating-point:
-	std::vector< float > data;
+	//change the budget (and trim to fit it):
+	void set_budget(size_t budget);
+	size_t budget;
+
+	//memory used by all loaded samples:
+	size_t resident_bytes() const;
+
+	//memory used by each sample:
+	struct Usage {
+		std::string filename; //(canonical path)
+		Sample::Format format;
+		size_t resident_bytes; //(0 if the sample has been freed)
+		uint32_t handles; //number of outstanding handles
+		uint32_t voices; //number of voices playing the sample
+	};
+	std::vector< Usage > usage() const;
+
+	//NOTE: keep the cache alive while any of its samples are playing.
+
+	//internals:
+	struct Entry {
+		std::shared_ptr< Sample > sample; //nullptr if freed
+		uint64_t last_used = 0; //last get() (compared with Sample::last_played)
+	};
+	std::map< std::pair< std::string, Sample::Format >, Entry > entries;
+	bool warned = false; //(warned that samples in use don't fit in the budget)
 };
 
 //Ramp<> manages values that should be smoothly interpolated
@@ -48,60 +165,146 @@ struct Ramp {
 	float ramp = 0.0f;
 };
 
-// 'PlayingSample' objects book-keep samples that are currently playing:
+//Effects process the mixed audio of a bus (see Bus::set_effects, below) one block at a time:
+struct Effect {
+	virtual ~Effect() { }
+	//process 'frames' frames of interleaved stereo (left, right, left, right, ...) 48kHz audio in place:
+	// (called on the audio thread, so don't allocate, lock, or do I/O in here)
+	virtual void process(float *samples, uint32_t frames) = 0;
+};
+
+// 'Bus' handles refer to submixes: every playing sample is mixed into a bus,
+// every bus is mixed into its parent bus, and the "master" bus is the output.
+// (the buses themselves are set up by Sound::init(); see Settings::buses, below)
+struct Bus {
+	//change the volume of everything playing through this bus, over 'ramp' seconds:
+	void set_volume(float new_volume, float ramp = 1.0f / 60.0f) const;
+
+	//replace the effects run (in order) on the bus's mixed audio each block:
+	// (effects aren't owned by the bus -- keep them alive while they are in use)
+	void set_effects(std::vector< Effect * > const &effects) const;
+
+	//internals:
+	uint32_t index = -1U; //index of bus in the mixer's bus list (-1U for an empty handle)
+};
+
+//look up a bus by name; throws if there is no such bus:
+Bus get_bus(std::string const &name);
+
+// 'PlayingSample' handles refer to samples that are currently playing.
+// Playing samples live in a fixed-capacity voice pool (see Settings::max_voices, below);
+// a handle names a slot in that pool plus the slot's generation count, so handles are cheap to copy,
+// and a handle to a sample that has finished (even if its slot has since been reused) is harmless.
 struct PlayingSample {
-	//change the panning or volume of a playing sample (and do proper locking);
+	//change the panning or volume of a playing sample (changes are queued for the audio thread; no locking);
 	// value will change over 'ramp' seconds to avoid creating audible artifacts:
-	void set_volume(float new_volume, float ramp = 1.0f / 60.0f);
+	void set_volume(float new_volume, float ramp = 1.0f / 60.0f) const;
 	//set the panning of a sample (use only on samples in "2D" mode; no effect on "3D" samples):
-	void set_pan(float new_pan, float ramp = 1.0f / 60.0f);
+	void set_pan(float new_pan, float ramp = 1.0f / 60.0f) const;
 	//set the position of a sample (use only on samples in "3D" mode; no effect on "2D" samples):
-	void set_position(glm::vec3 const &new_position, float ramp = 1.0f / 60.0f);
+	void set_position(glm::vec3 const &new_position, float ramp = 1.0f / 60.0f) const;
 	//set the half-volume radius (use only on "3D" playing sounds):
-	void set_half_volume_radius(float new_radius, float ramp = 1.0f / 60.0f);
+	void set_half_volume_radius(float new_radius, float ramp = 1.0f / 60.0f) const;
+
+	//set the playback rate (1.0 is normal; 2.0 is twice as fast and an octave higher; clamped to [0, 4]):
+	// (playing one sample at several rates is a cheap way to get pitch variants; no effect on streams)
+	void set_rate(float new_rate, float ramp = 1.0f / 60.0f) const;
+
+	//choose the bus that a sample plays through (by default, samples play through "sfx" and streams through "music"):
+	// (call right after playing a sample to have it play through 'bus' from the start)
+	void set_bus(Bus const &bus) const;
+
+	//set the priority of a sample; when more samples are playing than Settings::max_real_voices,
+	// higher-priority (then louder) samples are mixed and the rest play silently ("virtually") until there is room:
+	void set_priority(int32_t new_priority) const;
 
 	//'stop' will fade sample out over 'ramp' seconds and then remove it from the active samples:
-	void stop(float ramp = 1.0f / 60.0f);
+	void stop(float ramp = 1.0f / 60.0f) const;
+
+	//was playback stopped (either by running out of sample, or by stop())?
+	// (also true for empty handles -- e.g., if the voice pool was full when the sample was played)
+	bool stopped() const;
 
 	//internals:
-	//NOTE: PlayingSample is used in a separate thread; so setting these values directly
-	// may result in bad results. Instead, use the functions above, which perform locking!
-	std::vector< float > const &data; //reference to sample data being played
-	uint32_t i = 0; //next data value to read
-	bool loop = false; //should playback loop after data runs out?
-	bool stopping = false; //is playing stopping?
-	bool stopped = false; //was playback stopped (either by running out of sample, or by stop())?
-
-	Ramp< float > volume = Ramp< float >(1.0f);
-
-	//2D playback panning control: ('NaN' if sound played in 3D mode)
-	Ramp< float > pan = Ramp< float >(std::numeric_limits< float >::quiet_NaN());
-
-	//3D playback panning control: ('NaN' if sound played in 2D mode)
-	Ramp< glm::vec3 > position = Ramp< glm::vec3 >(std::numeric_limits< float >::quiet_NaN());
-	Ramp< float > half_volume_radius = std::numeric_limits< float >::quiet_NaN();
-
-	PlayingSample(Sample const &sample_, float volume_, float pan_, bool loop_)
-		: data(sample_.data), loop(loop_), volume(volume_), pan(pan_) { }
-	PlayingSample(Sample const &sample_, float volume_, glm::vec3 const &position_, float half_volume_radius_, bool loop_)
-		: data(sample_.data), loop(loop_), volume(volume_), position(position_), half_volume_radius(half_volume_radius_) { }
+	uint32_t slot = -1U; //slot in the voice pool (-1U for an empty handle)
+	uint32_t generation = 0; //generation of that slot when playback started
 };
 
 // ------- global functions -------
 
-void init(); //call Sound::init() from main.cpp before using any member functions
+//Settings for the audio system:
+struct Settings {
+	uint32_t max_voices = 256; //capacity of the voice pool (maximum number of simultaneously playing samples)
+	uint32_t max_real_voices = 64; //how many of those are actually mixed each block (the rest are "virtual": they advance but are silent)
+	bool open_device = true; //if false, no audio device is opened; use Sound::render() to run the mixer instead (e.g., for tools and benchmarks)
+
+	//3D samples farther than this many half-volume radii from the listener are "far" (at 100, they are ~40dB quieter than at one radius):
+	// far samples are set aside in a spatial hash -- skipped entirely by the mixer, not even attenuated or panned --
+	// and only the part of the hash around the listener is checked each block to find samples coming back into range
+	// (so scenes can have tens of thousands of distant emitters; 0 turns this off)
+	float far_radii = 100.0f;
+
+	//threads that mix voices (counting the audio thread; 0 means one per core):
+	// with more than 1, voices are split between the audio thread and "worker" threads, each pinned to its own core where possible
+	// (for scenes with thousands of voices -- e.g., crowds -- that are too much for one core to mix in time; the output doesn't depend on timing)
+	uint32_t mix_threads = 1;
+
+	//strict real-time mode, for when the audio thread must never miss a deadline:
+	// the audio thread asks for real-time scheduling priority, mixer buffers are locked into memory (so they never page out),
+	// and the game thread never locks out the audio thread (Sound::lock() warns; a full command queue waits instead)
+	// (real-time priority may need permission -- e.g., an rtprio limit on Linux; if it isn't granted, this only warns)
+	// with mix_threads > 1, workers get real-time priority too and are woken without locks -- but a block still waits for
+	// any worker that is partway through its voices, so pin the audio thread (audio_thread_core) to keep workers off its core
+	bool realtime = false;
+
+	//if set, pin the audio thread to this core (where supported):
+	uint32_t audio_thread_core = -1U;
+
+	//samples mixed per block -- 128, 256, 512, or 1024 (about 2.7, 5.3, 10.7, or 21.3ms at 48kHz):
+	// smaller blocks mean lower latency (e.g., for rhythm games) but more mixer overhead (and more battery use)
+	uint32_t block_size = 1024;
+
+	//if set, '.opus' samples are decoded just once, into this directory, then memory-mapped from there on later runs:
+	// (see pcm_cache.hpp; e.g., data_path("pcm-cache"))
+	std::string pcm_cache_directory = "";
+
+	//if set, every command sent to the mixer (plays, set_*, stops, listener and volume changes, ...) is recorded in this file,
+	// stamped with the block it took effect in; 'replay-sound' renders the recording again -- exactly -- with the offline mixer
+	// (e.g., to check a mixer change bit-for-bit, or to profile a real play session; see sound_capture.hpp for what isn't recorded)
+	std::string capture_file = "";
+
+	//buses (named in 'buses', below) that mix in first-order ambisonics ("B-format") instead of stereo:
+	// 3D samples playing through these are encoded by their direction in the world -- which doesn't change when the listener turns --
+	// and the whole bus is turned to face the listener and decoded to stereo once per block, so turning costs the same for 5 samples or 5000
+	// (only samples and streams play through an ambisonic bus -- other buses can't mix into one -- and "master" can't be one)
+	std::vector< std::string > ambisonic_buses = {};
+
+	//submix buses, as (name, parent) pairs (in any order, as long as every bus eventually mixes into "master"):
+	// (the "master" bus is always present; it is the output)
+	std::vector< std::pair< std::string, std::string > > buses = {
+		{"sfx", "master"},
+		{"music", "master"},
+		{"ui", "master"},
+	};
+};
+
+void init(Settings const &settings = Settings()); //call Sound::init() from main.cpp before using any member functions
 
 void shutdown(); //call Sound::shutdown() from main.cpp to gracefully(-ish) exit
 
+//change the block size (see Settings::block_size) while running; the audio device is reopened, and playback carries on:
+void set_block_size(uint32_t block_size);
+uint32_t block_size();
+
 //Call 'Sound::play' to play a sample once.
 //  if you hang on to the return value, you can change the panning, volume, or stop playback early.
-std::shared_ptr< PlayingSample > play(
+PlayingSample play(
 	Sample const &sample,
 	float volume = 1.0f,
 	float pan = 0.0f //-1.0f == hard left, 1.0f == hard right
 );
 //The play_3D version will play a sample in '3D' mode (that is, panning determined by listener position):
-std::shared_ptr< PlayingSample > play_3D(
+PlayingSample play_3D(
 	Sample const &sample,
 	float volume,
 	glm::vec3 const &position,
@@ -110,19 +313,65 @@ std::shared_ptr< PlayingSample > play_3D(
 
 //Call 'Sound::loop' to play a sample ~forever~.
 //  if you hang on to the return value, you can change the panning, volume, or stop playback.
-std::shared_ptr< PlayingSample > loop(
+PlayingSample loop(
 	Sample const &sample,
 	float volume = 1.0f,
 	float pan = 0.0f //-1.0f == hard left, 1.0f == hard right
 );
 //The loop_3D version will loop a sample in '3D' mode (that is, panning determined by listener position):
-std::shared_ptr< PlayingSample > loop_3D(
+PlayingSample loop_3D(
+	Sample const &sample,
+	float volume,
+	glm::vec3 const &position,
+	float half_volume_radius = std::numeric_limits< float >::infinity()
+);
+
+//Sample-accurate scheduling: these versions start playback exactly at 'time' on the audio clock (see audio_clock(), below),
+//  even partway through a mixer block. (If the mixer has already passed 'time' when it gets the sample, it starts right away;
+//  so schedule at least a block -- see block_size() -- past audio_clock() to be sure of sample accuracy.)
+PlayingSample play_at(
+	Sample const &sample,
+	double time,
+	float volume = 1.0f,
+	float pan = 0.0f //-1.0f == hard left, 1.0f == hard right
+);
+PlayingSample play_3D_at(
+	Sample const &sample,
+	double time,
+	float volume,
+	glm::vec3 const &position,
+	float half_volume_radius = std::numeric_limits< float >::infinity()
+);
+PlayingSample loop_at(
+	Sample const &sample,
+	double time,
+	float volume = 1.0f,
+	float pan = 0.0f //-1.0f == hard left, 1.0f == hard right
+);
+PlayingSample loop_3D_at(
 	Sample const &sample,
+	double time,
 	float volume,
 	glm::vec3 const &position,
 	float half_volume_radius = std::numeric_limits< float >::infinity()
 );
 
+//The audio clock -- seconds of audio mixed since Sound::init(); it only moves forward, a block at a time.
+// (what is audible right now lags a little behind this, since the audio device buffers about a block)
+double audio_clock();
+
+//Streams can also be played (or looped) in '2D' mode:
+PlayingSample play(
+	Stream &stream,
+	float volume = 1.0f,
+	float pan = 0.0f //-1.0f == hard left, 1.0f == hard right
+);
+PlayingSample loop(
+	Stream &stream,
+	float volume = 1.0f,
+	float pan = 0.0f //-1.0f == hard left, 1.0f == hard right
+);
+
 //Listener controls the panning of "3D" samples (ones played using the "position" version of the play functions):
 struct Listener {
 	void set_position_right(glm::vec3 const &new_position, glm::vec3 const &new_right, float ramp = 1.0f / 60.0f);
@@ -140,9 +389,47 @@ void stop_all_samples();
 void set_volume(float new_volume, float ramp = 1.0f / 60.0f);
 extern Ramp< float > volume;
 
+//Offline rendering -- runs the mixer as fast as possible, without an audio device.
+// (call Sound::init() with Settings::open_device = false first)
+//Mixes the next 'frames' frames of output into 'out' (interleaved left/right, so 2 * frames floats);
+// commands (play, set_*, stop, ...) issued between calls take effect at the next block boundary, just as in live playback.
+//If 'voices_mixed' is given, the number of voices mixed in each block rendered is added to it:
+void render(float *out, uint32_t frames, uint64_t *voices_mixed = nullptr);
+
+//Mixer measurements, recorded by the audio thread every block (through a lock-free queue, so this is cheap to leave on):
+struct BlockStats {
+	uint64_t block = 0; //index of the block (counting from Sound::init())
+	uint32_t frames = 0; //size of the block (see Settings::block_size)
+	float mix_seconds = 0.0f; //wall-clock time spent mixing the block
+	uint32_t voices_playing = 0; //voices playing (real, virtual, or far) at the end of the block
+	uint32_t voices_far = 0; //...of which are too far away to hear (see Settings::far_radii)
+	uint32_t voices_mixed = 0; //voices actually mixed
+	uint32_t voices_finished = 0; //voices that finished during the block
+	float peak = 0.0f; //largest absolute output sample value
+	bool missed_deadline = false; //mixing took longer than the block takes to play (so the device probably underran)
+};
+
+struct Stats {
+	uint64_t blocks = 0; //blocks mixed since Sound::init()
+	uint64_t missed_deadlines = 0; //blocks that missed their deadline
+	uint64_t dropped = 0; //blocks that aren't in 'history' because Sound::stats() wasn't called often enough
+	float deadline_seconds = 0.0f; //time each block (at the current block size) takes to play (mixing must finish faster than this)
+	float max_mix_seconds = 0.0f; //slowest block
+	float peak = 0.0f; //loudest output sample value
+	std::deque< BlockStats > history; //most recent blocks (oldest first; up to a few hundred)
+};
+
+//collect new measurements from the audio thread (call from the game thread; e.g., once per frame or when something sounds wrong):
+Stats const &stats();
+
+//write stats().history to a CSV file (one row per block); throws on error:
+void write_stats_csv(std::string const &filename);
+
 //the audio callback doesn't run between Sound::lock() and Sound::unlock()
-// the set_*/stop/play/... functions already use these helpers, so you shouldn't need
-// to call them unless your code is modifying values directly:
+// the set_*/stop/play/... functions don't need these helpers (they pass commands to the audio thread
+// through a lock-free queue), so you shouldn't need to call them unless your code is modifying values
+// (e.g., Sound::volume or Sound::listener) directly.
+//NOTE: the command queue is single-producer -- only call the set_*/stop/play/... functions from one (game) thread.
 void lock();
 void unlock();
 
@@ -0,0 +1,50 @@
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+
+WorkerPool::WorkerPool(uint32_t count) {
+	if (count == 0) count = std::max(1U, std::thread::hardware_concurrency());
+	threads.reserve(count);
+	for (uint32_t t = 0; t < count; ++t) {
+		threads.emplace_back([this](){
+			while (true) {
+				std::packaged_task< void() > job;
+				{
+					std::unique_lock< std::mutex > lock(mutex);
+					wake.wait(lock, [this](){ return quit || !jobs.empty(); });
+					if (jobs.empty()) break; //(only when quitting)
+					job = std::move(jobs.front());
+					jobs.pop_front();
+				}
+				job(); //(exceptions are caught by the task and stored in its future)
+			}
+		});
+	}
+}
+
+WorkerPool::~WorkerPool() {
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+	for (auto &thread : threads) {
+		thread.join();
+	}
+}
+
+std::shared_future< void > WorkerPool::run(std::function< void() > const &job) {
+	std::packaged_task< void() > task(job);
+	std::shared_future< void > future = task.get_future().share();
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		jobs.emplace_back(std::move(task));
+	}
+	wake.notify_one();
+	return future;
+}
+
+WorkerPool &WorkerPool::shared() {
+	static WorkerPool pool;
+	return pool;
+}
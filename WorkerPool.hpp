@@ -0,0 +1,47 @@
+#pragma once
+
+/*
+ * A WorkerPool runs jobs on a set of background threads.
+ *
+ * It is used to spread slow, independent work (e.g., decoding sound files while loading) across all cores:
+ *
+ * std::shared_future< void > done = WorkerPool::shared().run([](){ ... });
+ * //...later:
+ * done.get(); //waits for the job (and rethrows anything it threw)
+ *
+ * Jobs run in the order they were queued, but (with more than one thread) may finish in any order.
+ *
+ */
+
+#include <functional>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <cstdint>
+
+struct WorkerPool {
+	//start 'threads' worker threads (0 means one per hardware thread):
+	WorkerPool(uint32_t threads = 0);
+	//finishes all queued jobs, then stops the threads:
+	~WorkerPool();
+
+	WorkerPool(WorkerPool const &) = delete;
+	WorkerPool &operator=(WorkerPool const &) = delete;
+
+	//queue a job; the returned future becomes ready once it has run:
+	// (if the job throws, the exception is rethrown by the future's get())
+	std::shared_future< void > run(std::function< void() > const &job);
+
+	//pool shared by everything that just wants some work done in the background (created on first use):
+	static WorkerPool &shared();
+
+	//internals:
+	std::vector< std::thread > threads;
+	std::mutex mutex; //guards 'jobs' and 'quit'
+	std::condition_variable wake; //signalled when a job is queued (or on quit)
+	std::deque< std::packaged_task< void() > > jobs;
+	bool quit = false;
+};
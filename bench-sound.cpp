@@ -0,0 +1,639 @@
+//bench-sound: microbenchmarks for the Sound mixer.
+// runs the mixer offline (no audio device; see Sound::render) and reports timings on stdout.
+//
+//usage: bench-sound [voices|rotation|rate|blocks|formats|threads|reverb|far|ambisonic ...]  (default: run everything)
+//
+//"ns/sample/voice" is the mixer's time per output sample per playing voice;
+//"headroom" is how many times over the mixer could run in the time one block
+// (MIX_SAMPLES samples at 48kHz) takes to play -- below 1.0x the audio device would underrun.
+
+#include "Sound.hpp"
+#include "ConvolutionReverb.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <thread>
+
+//block size most benchmarks run at (passed to Sound::init), and output rate (must match Sound.cpp):
+constexpr uint32_t const MIX_SAMPLES = 1024;
+constexpr uint32_t const AUDIO_RATE = 48000;
+
+//internal helper, defined in Sound.cpp:
+void step_direction_ramp(Sound::Ramp< glm::vec3 > &ramp);
+
+//time the audio device gives the mixer to produce one block:
+constexpr double const BLOCK_SECONDS = double(MIX_SAMPLES) / double(AUDIO_RATE);
+
+//run the mixer for 'blocks' blocks; returns elapsed seconds:
+static double mix_blocks(uint32_t blocks) {
+	static std::vector< float > buffer(2 * MIX_SAMPLES);
+	uint32_t block_size = Sound::block_size();
+	auto before = std::chrono::high_resolution_clock::now();
+	for (uint32_t b = 0; b < blocks; ++b) {
+		Sound::render(buffer.data(), block_size);
+	}
+	auto after = std::chrono::high_resolution_clock::now();
+	return std::chrono::duration< double >(after - before).count();
+}
+
+//stop everything and let the mixer retire the voices:
+static void reset_voices() {
+	Sound::stop_all_samples();
+	mix_blocks(2);
+}
+
+//some test audio -- a few tones plus a little noise:
+static std::vector< float > make_test_audio(uint32_t length) {
+	std::mt19937 mt(0x5eed);
+	std::uniform_real_distribution< float > noise(-0.05f, 0.05f);
+	std::vector< float > audio(length);
+	for (uint32_t i = 0; i < length; ++i) {
+		float t = float(i) / float(AUDIO_RATE);
+		audio[i] = 0.4f * std::sin(2.0f * 3.1415926f * 220.0f * t)
+		         + 0.2f * std::sin(2.0f * 3.1415926f * 1375.0f * t)
+		         + 0.1f * std::sin(2.0f * 3.1415926f * 5100.0f * t)
+		         + noise(mt);
+	}
+	return audio;
+}
+
+//------------------------------------------------
+//voice counts: cost of mixing 1 .. 4096 voices, 2D vs 3D, looped vs one-shot
+
+static void bench_voice_counts() {
+	constexpr uint32_t const MaxBlocks = 400;
+	constexpr uint32_t const WarmupBlocks = 10;
+
+	//one-shot voices play a sample long enough that they never finish during timing;
+	// looped voices play a short sample, so they wrap many times:
+	Sound::Sample one_shot(make_test_audio((MaxBlocks + WarmupBlocks + 2) * MIX_SAMPLES));
+	Sound::Sample looped(make_test_audio(AUDIO_RATE / 4 + 17)); //(+17 so wraps don't line up with blocks)
+
+	std::cout << "\n--- voice counts (budget " << std::fixed << std::setprecision(2) << BLOCK_SECONDS * 1e3 << " ms/block) ---\n";
+	std::cout << std::setw(10) << "mode"
+	          << std::setw(8) << "voices"
+	          << std::setw(18) << "ns/sample/voice"
+	          << std::setw(12) << "us/block"
+	          << std::setw(12) << "% budget"
+	          << std::setw(12) << "headroom" << '\n';
+
+	struct { bool is_3D; bool loop; char const *name; } modes[] = {
+		{false, false, "2D once"},
+		{false, true, "2D loop"},
+		{true, false, "3D once"},
+		{true, true, "3D loop"},
+	};
+	for (auto const &mode : modes) {
+		for (uint32_t voices = 1; voices <= 4096; voices *= 4) {
+			Sound::Sample const &sample = (mode.loop ? looped : one_shot);
+			for (uint32_t v = 0; v < voices; ++v) {
+				float volume = 1.0f / voices;
+				float pan = (voices > 1 ? 2.0f * v / (voices - 1) - 1.0f : 0.0f);
+				float angle = 6.2831853f * float(v) / float(voices);
+				glm::vec3 position = (1.0f + 9.0f * float(v) / float(voices)) * glm::vec3(std::cos(angle), std::sin(angle), 0.0f);
+				if (mode.is_3D) {
+					if (mode.loop) Sound::loop_3D(sample, volume, position, 5.0f);
+					else Sound::play_3D(sample, volume, position, 5.0f);
+				} else {
+					if (mode.loop) Sound::loop(sample, volume, pan);
+					else Sound::play(sample, volume, pan);
+				}
+			}
+
+			//keep the total work roughly constant across voice counts:
+			uint32_t blocks = std::max(16U, std::min(MaxBlocks, 16384U / voices));
+			mix_blocks(WarmupBlocks);
+			double seconds = mix_blocks(blocks);
+			reset_voices();
+
+			double block_seconds = seconds / blocks;
+			std::cout << std::setw(10) << mode.name
+			          << std::setw(8) << voices
+			          << std::setw(18) << std::setprecision(3) << block_seconds * 1e9 / (double(MIX_SAMPLES) * voices)
+			          << std::setw(12) << std::setprecision(1) << block_seconds * 1e6
+			          << std::setw(12) << std::setprecision(2) << 100.0 * block_seconds / BLOCK_SECONDS
+			          << std::setw(11) << std::setprecision(1) << BLOCK_SECONDS / block_seconds << "x" << '\n';
+		}
+	}
+}
+
+//------------------------------------------------
+//listener rotation: 3D panning while the listener's 'right' vector is always ramping
+
+static void bench_listener_rotation() {
+	constexpr uint32_t const Blocks = 200;
+
+	std::cout << "\n--- listener rotation ---\n";
+
+	//the direction ramp on its own:
+	{
+		constexpr uint32_t const Steps = 1000000;
+		Sound::Ramp< glm::vec3 > right(1.0f, 0.0f, 0.0f);
+		float angle = 0.0f;
+		auto before = std::chrono::high_resolution_clock::now();
+		for (uint32_t i = 0; i < Steps; ++i) {
+			//every few steps, aim somewhere new (sometimes exactly opposite, which hits the degenerate-plane case):
+			if (i % 4 == 0) {
+				angle += (i % 64 == 0 ? 3.1415926f : 1.3f);
+				right.set(glm::vec3(std::cos(angle), std::sin(angle), 0.0f), 10.0f * float(BLOCK_SECONDS));
+			}
+			step_direction_ramp(right);
+		}
+		auto after = std::chrono::high_resolution_clock::now();
+		double seconds = std::chrono::duration< double >(after - before).count();
+		std::cout << "step_direction_ramp: " << std::fixed << std::setprecision(2) << seconds * 1e9 / Steps << " ns/step"
+		          << " (result " << std::setprecision(3) << right.value.x << ", " << right.value.y << ")\n";
+	}
+
+	//the whole mixer, with the listener still vs. spinning:
+	Sound::Sample sample(make_test_audio(AUDIO_RATE / 4 + 17));
+	std::cout << std::setw(10) << "listener"
+	          << std::setw(8) << "voices"
+	          << std::setw(18) << "ns/sample/voice"
+	          << std::setw(12) << "headroom" << '\n';
+	for (uint32_t voices : {64U, 1024U, 4096U}) {
+		for (bool spin : {false, true}) {
+			for (uint32_t v = 0; v < voices; ++v) {
+				float angle = 6.2831853f * float(v) / float(voices);
+				Sound::loop_3D(sample, 1.0f / voices, 5.0f * glm::vec3(std::cos(angle), std::sin(angle), 0.0f), 5.0f);
+			}
+			mix_blocks(10);
+
+			double seconds = 0.0;
+			float angle = 0.0f;
+			for (uint32_t b = 0; b < Blocks; ++b) {
+				if (spin) {
+					//a new target half a turn away every block, always mid-ramp:
+					angle += 1.5f;
+					Sound::listener.set_position_right(glm::vec3(0.0f), glm::vec3(std::cos(angle), std::sin(angle), 0.0f), 4.0f * float(BLOCK_SECONDS));
+				}
+				seconds += mix_blocks(1);
+			}
+			reset_voices();
+			Sound::listener.set_position_right(glm::vec3(0.0f), glm::vec3(1.0f, 0.0f, 0.0f), 0.0f);
+			mix_blocks(1);
+
+			double block_seconds = seconds / Blocks;
+			std::cout << std::setw(10) << (spin ? "spinning" : "still")
+			          << std::setw(8) << voices
+			          << std::setw(18) << std::setprecision(3) << block_seconds * 1e9 / (double(MIX_SAMPLES) * voices)
+			          << std::setw(11) << std::setprecision(1) << BLOCK_SECONDS / block_seconds << "x" << '\n';
+		}
+	}
+}
+
+//------------------------------------------------
+//playback rate: cost of resampling voices that aren't playing at rate 1.0
+
+static void bench_playback_rate() {
+	constexpr uint32_t const Voices = 256;
+	constexpr uint32_t const Blocks = 200;
+
+	Sound::Sample sample(make_test_audio(AUDIO_RATE / 4 + 17));
+
+	std::cout << "\n--- playback rate (" << Voices << " looping voices, " << Blocks << " blocks) ---\n";
+	std::cout << std::setw(10) << "rate"
+	          << std::setw(18) << "ns/sample/voice"
+	          << std::setw(10) << "vs 1.0" << '\n';
+
+	double base_ns = 0.0;
+	struct { float rate; bool ramping; char const *name; } rates[] = {
+		{1.0f, false, "1.0"},
+		{0.5f, false, "0.5"},
+		{1.5f, false, "1.5"},
+		{4.0f, false, "4.0"},
+		{1.0f, true, "ramping"},
+	};
+	for (auto const &r : rates) {
+		std::vector< Sound::PlayingSample > playing;
+		for (uint32_t v = 0; v < Voices; ++v) {
+			playing.emplace_back(Sound::loop(sample, 1.0f / Voices, 2.0f * v / (Voices - 1) - 1.0f));
+			playing.back().set_rate(r.rate, 0.0f);
+		}
+		mix_blocks(10);
+
+		double seconds = 0.0;
+		for (uint32_t b = 0; b < Blocks; ++b) {
+			if (r.ramping && b % 8 == 0) {
+				for (uint32_t v = 0; v < Voices; ++v) {
+					playing[v].set_rate((b % 16 == 0 ? 0.8f : 1.25f) + 0.001f * v, 8.0f * float(BLOCK_SECONDS));
+				}
+			}
+			seconds += mix_blocks(1);
+		}
+		reset_voices();
+
+		double ns = seconds * 1e9 / (double(Blocks) * MIX_SAMPLES * Voices);
+		if (base_ns == 0.0) base_ns = ns;
+		std::cout << std::setw(10) << r.name
+		          << std::setw(18) << std::fixed << std::setprecision(3) << ns
+		          << std::setw(10) << std::setprecision(2) << ns / base_ns << '\n';
+	}
+}
+
+//------------------------------------------------
+//block sizes: mixer overhead at each latency setting
+
+static void bench_block_sizes() {
+	constexpr uint32_t const Voices = 256;
+	constexpr uint32_t const Samples = 200 * MIX_SAMPLES; //(same amount of audio for every block size)
+
+	Sound::Sample sample(make_test_audio(AUDIO_RATE / 4 + 17));
+
+	std::cout << "\n--- block sizes (" << Voices << " looping 3D voices, moving) ---\n";
+	std::cout << std::setw(8) << "block"
+	          << std::setw(12) << "latency"
+	          << std::setw(18) << "ns/sample/voice"
+	          << std::setw(12) << "headroom" << '\n';
+
+	for (uint32_t block_size : {128U, 256U, 512U, 1024U}) {
+		Sound::set_block_size(block_size);
+		std::vector< Sound::PlayingSample > playing;
+		for (uint32_t v = 0; v < Voices; ++v) {
+			float angle = 6.2831853f * float(v) / float(Voices);
+			playing.emplace_back(Sound::loop_3D(sample, 1.0f / Voices, 5.0f * glm::vec3(std::cos(angle), std::sin(angle), 0.0f), 5.0f));
+		}
+		mix_blocks(10);
+
+		//keep every voice's position ramping, so per-block parameter work is included:
+		uint32_t blocks = Samples / block_size;
+		double seconds = 0.0;
+		for (uint32_t b = 0; b < blocks; ++b) {
+			if (b % 16 == 0) {
+				for (uint32_t v = 0; v < Voices; ++v) {
+					float angle = 6.2831853f * float(v) / float(Voices) + 0.01f * b;
+					playing[v].set_position(5.0f * glm::vec3(std::cos(angle), std::sin(angle), 0.0f), 0.25f);
+				}
+			}
+			seconds += mix_blocks(1);
+		}
+		reset_voices();
+
+		double block_seconds = seconds / blocks;
+		double deadline = double(block_size) / AUDIO_RATE;
+		std::cout << std::setw(8) << block_size
+		          << std::setw(10) << std::fixed << std::setprecision(1) << deadline * 1e3 << "ms"
+		          << std::setw(18) << std::setprecision(3) << block_seconds * 1e9 / (double(block_size) * Voices)
+		          << std::setw(11) << std::setprecision(1) << deadline / block_seconds << "x" << '\n';
+	}
+	Sound::set_block_size(MIX_SAMPLES);
+}
+
+//------------------------------------------------
+//sample formats: memory used vs. cost to mix
+
+static void bench_sample_formats() {
+	constexpr uint32_t const Voices = 64;
+	constexpr uint32_t const Blocks = 500;
+
+	std::vector< float > audio = make_test_audio(2 * 48000);
+
+	std::cout << "\n--- sample formats (" << Voices << " looping voices, " << Blocks << " blocks) ---\n";
+	std::cout << std::setw(10) << "format"
+	          << std::setw(14) << "bytes"
+	          << std::setw(10) << "ratio"
+	          << std::setw(12) << "SNR (dB)"
+	          << std::setw(18) << "ns/sample/voice"
+	          << std::setw(10) << "vs float" << '\n';
+
+	double float_ns = 0.0;
+	size_t float_bytes = 0;
+	struct { Sound::Sample::Format format; char const *name; } formats[] = {
+		{Sound::Sample::Float32, "Float32"},
+		{Sound::Sample::Int16, "Int16"},
+		{Sound::Sample::ADPCM, "ADPCM"},
+	};
+	for (auto const &f : formats) {
+		Sound::Sample sample(audio, f.format);
+
+		//quality:
+		std::vector< float > decoded(sample.length);
+		sample.decode(0, sample.length, decoded.data());
+		double signal = 0.0, error = 0.0;
+		for (uint32_t i = 0; i < sample.length; ++i) {
+			signal += double(audio[i]) * audio[i];
+			error += double(audio[i] - decoded[i]) * (audio[i] - decoded[i]);
+		}
+		double snr = (error > 0.0 ? 10.0 * std::log10(signal / error) : std::numeric_limits< double >::infinity());
+
+		//mixing cost:
+		for (uint32_t v = 0; v < Voices; ++v) {
+			Sound::loop(sample, 1.0f / Voices, 2.0f * v / (Voices - 1) - 1.0f);
+		}
+		mix_blocks(10); //warm up
+		double seconds = mix_blocks(Blocks);
+		reset_voices();
+
+		double ns = seconds * 1e9 / (double(Blocks) * MIX_SAMPLES * Voices);
+		if (f.format == Sound::Sample::Float32) {
+			float_ns = ns;
+			float_bytes = sample.resident_bytes();
+		}
+
+		std::cout << std::setw(10) << f.name
+		          << std::setw(14) << sample.resident_bytes()
+		          << std::setw(10) << std::fixed << std::setprecision(2) << double(float_bytes) / sample.resident_bytes()
+		          << std::setw(12) << std::setprecision(1) << snr
+		          << std::setw(18) << std::setprecision(3) << ns
+		          << std::setw(10) << std::setprecision(2) << ns / float_ns << '\n';
+	}
+}
+
+//------------------------------------------------
+//mixer threads: splitting voices between the audio thread and worker threads (see Settings::mix_threads)
+
+static void bench_mix_threads(Sound::Settings settings) {
+	constexpr uint32_t const Voices = 2048;
+	constexpr uint32_t const Blocks = 200;
+
+	Sound::Sample sample(make_test_audio(AUDIO_RATE / 4 + 17));
+
+	//mix a ring of 3D voices with 'threads' threads, keeping the output; returns seconds per block:
+	auto run = [&](uint32_t threads, std::vector< float > *output) {
+		settings.mix_threads = threads;
+		Sound::init(settings);
+		for (uint32_t v = 0; v < Voices; ++v) {
+			float angle = 6.2831853f * float(v) / float(Voices);
+			Sound::loop_3D(sample, 1.0f / Voices, 5.0f * glm::vec3(std::cos(angle), std::sin(angle), 0.0f), 5.0f);
+		}
+		output->assign(2 * size_t(Blocks) * MIX_SAMPLES, 0.0f);
+		auto before = std::chrono::high_resolution_clock::now();
+		for (uint32_t b = 0; b < Blocks; ++b) {
+			Sound::render(output->data() + 2 * size_t(b) * MIX_SAMPLES, MIX_SAMPLES);
+		}
+		auto after = std::chrono::high_resolution_clock::now();
+		reset_voices();
+		return std::chrono::duration< double >(after - before).count() / Blocks;
+	};
+
+	uint32_t cores = std::max(1U, std::thread::hardware_concurrency());
+	std::cout << "\n--- mixer threads (" << Voices << " 3D voices, " << cores << " cores) ---\n";
+	std::cout << std::setw(8) << "threads"
+	          << std::setw(12) << "us/block"
+	          << std::setw(10) << "speedup"
+	          << std::setw(12) << "headroom"
+	          << std::setw(12) << "repeatable" << '\n';
+
+	double one_thread = 0.0;
+	for (uint32_t threads = 1; threads <= std::max(2U, cores); threads *= 2) {
+		//(mixing the same scene twice should give exactly the same output, however the work was split up)
+		std::vector< float > first, second;
+		double seconds = run(threads, &first);
+		seconds = std::min(seconds, run(threads, &second));
+		if (threads == 1) one_thread = seconds;
+
+		std::cout << std::setw(8) << threads
+		          << std::setw(12) << std::fixed << std::setprecision(1) << seconds * 1e6
+		          << std::setw(9) << std::setprecision(2) << one_thread / seconds << "x"
+		          << std::setw(11) << std::setprecision(1) << BLOCK_SECONDS / seconds << "x"
+		          << std::setw(12) << (first == second ? "yes" : "NO") << '\n';
+	}
+
+	settings.mix_threads = 1;
+	Sound::init(settings);
+}
+
+//------------------------------------------------
+//reverb: partitioned FFT convolution (ConvolutionReverb) vs convolving directly, for impulse responses of various lengths
+
+//direct-form convolution, for comparison (and to check ConvolutionReverb's output against):
+struct DirectConvolution : Sound::Effect {
+	DirectConvolution(std::vector< float > const &impulse, float wet_, float dry_) : reversed(impulse.rbegin(), impulse.rend()), wet(wet_), dry(dry_) {
+		for (auto &history : histories) {
+			history.assign(reversed.size() - 1, 0.0f);
+		}
+	}
+	virtual void process(float *samples, uint32_t frames) override {
+		uint32_t taps = uint32_t(reversed.size());
+		for (uint32_t c = 0; c < 2; ++c) {
+			//history holds the last taps - 1 input samples, followed by this block's:
+			std::vector< float > &history = histories[c];
+			history.resize(taps - 1 + frames);
+			for (uint32_t i = 0; i < frames; ++i) {
+				history[taps - 1 + i] = samples[2*i+c];
+			}
+			for (uint32_t i = 0; i < frames; ++i) {
+				float const *x = history.data() + i;
+				float sum = 0.0f;
+				for (uint32_t k = 0; k < taps; ++k) {
+					sum += reversed[k] * x[k];
+				}
+				samples[2*i+c] = dry * samples[2*i+c] + wet * sum;
+			}
+			history.erase(history.begin(), history.begin() + frames);
+		}
+	}
+	std::vector< float > reversed; //impulse response, backward
+	std::vector< float > histories[2];
+	float wet, dry;
+};
+
+static void bench_reverb() {
+	constexpr uint32_t const Blocks = 8;
+
+	//an impulse response that sounds vaguely like a room -- noise decaying by 60dB over its length:
+	auto make_impulse = [](uint32_t length) {
+		std::mt19937 mt(0x7e7b);
+		std::uniform_real_distribution< float > noise(-1.0f, 1.0f);
+		std::vector< float > impulse(length);
+		for (uint32_t i = 0; i < length; ++i) {
+			impulse[i] = 0.05f * noise(mt) * std::pow(10.0f, -3.0f * float(i) / float(length));
+		}
+		return impulse;
+	};
+	std::vector< float > input = make_test_audio(Blocks * MIX_SAMPLES);
+
+	//run 'effect' over the test audio (as stereo), keeping the output; returns seconds per block:
+	auto run = [&](Sound::Effect &effect, std::vector< float > *output) {
+		output->assign(2 * size_t(Blocks) * MIX_SAMPLES, 0.0f);
+		for (uint32_t i = 0; i < input.size(); ++i) {
+			(*output)[2*i+0] = input[i];
+			(*output)[2*i+1] = -input[i];
+		}
+		auto before = std::chrono::high_resolution_clock::now();
+		for (uint32_t b = 0; b < Blocks; ++b) {
+			effect.process(output->data() + 2 * size_t(b) * MIX_SAMPLES, MIX_SAMPLES);
+		}
+		auto after = std::chrono::high_resolution_clock::now();
+		return std::chrono::duration< double >(after - before).count() / Blocks;
+	};
+
+	std::cout << "\n--- convolution reverb (" << MIX_SAMPLES << "-sample partitions, stereo) ---\n";
+	std::cout << std::setw(10) << "impulse"
+	          << std::setw(14) << "direct us"
+	          << std::setw(14) << "fft us"
+	          << std::setw(10) << "speedup"
+	          << std::setw(12) << "headroom"
+	          << std::setw(12) << "max error" << '\n';
+
+	for (float seconds : {0.1f, 0.5f, 1.0f, 2.0f}) {
+		std::vector< float > impulse = make_impulse(uint32_t(seconds * AUDIO_RATE));
+		DirectConvolution direct(impulse, 1.0f, 0.0f);
+		ConvolutionReverb reverb(impulse, 1.0f, 0.0f, MIX_SAMPLES);
+
+		std::vector< float > direct_output, reverb_output;
+		double direct_seconds = run(direct, &direct_output);
+		double reverb_seconds = run(reverb, &reverb_output);
+
+		float error = 0.0f;
+		for (uint32_t i = 0; i < direct_output.size(); ++i) {
+			error = std::max(error, std::abs(direct_output[i] - reverb_output[i]));
+		}
+
+		std::cout << std::setw(9) << std::fixed << std::setprecision(1) << seconds << "s"
+		          << std::setw(14) << std::setprecision(1) << direct_seconds * 1e6
+		          << std::setw(14) << std::setprecision(1) << reverb_seconds * 1e6
+		          << std::setw(9) << std::setprecision(1) << direct_seconds / reverb_seconds << "x"
+		          << std::setw(11) << std::setprecision(1) << BLOCK_SECONDS / reverb_seconds << "x"
+		          << std::setw(12) << std::scientific << std::setprecision(1) << error << '\n';
+	}
+}
+
+//------------------------------------------------
+//far voices: an open world full of distant 3D emitters, with and without setting far voices aside (see Settings::far_radii)
+
+static void bench_far_voices(Sound::Settings settings) {
+	constexpr uint32_t const Side = 128; //emitters on a Side x Side grid...
+	constexpr float const Spacing = 40.0f; //...this far apart
+	constexpr uint32_t const Blocks = 100;
+
+	Sound::Sample sample(make_test_audio(AUDIO_RATE / 4 + 17));
+
+	std::cout << "\n--- far voices (" << Side * Side << " 3D emitters, " << Spacing << "m apart, half-volume radius 2m) ---\n";
+	std::cout << std::setw(10) << "far_radii"
+	          << std::setw(12) << "us/block"
+	          << std::setw(10) << "far"
+	          << std::setw(10) << "speedup"
+	          << std::setw(12) << "headroom" << '\n';
+
+	settings.max_voices = std::max(settings.max_voices, Side * Side);
+	double all_seconds = 0.0;
+	for (float far_radii : {0.0f, 100.0f, 25.0f}) {
+		settings.far_radii = far_radii;
+		Sound::init(settings);
+		for (uint32_t z = 0; z < Side; ++z) {
+			for (uint32_t x = 0; x < Side; ++x) {
+				Sound::loop_3D(sample, 0.25f, Spacing * glm::vec3(float(x), 0.0f, float(z)), 2.0f);
+			}
+		}
+		Sound::listener.set_position_right(glm::vec3(0.0f), glm::vec3(1.0f, 0.0f, 0.0f), 0.0f);
+		mix_blocks(4);
+
+		//walk the listener diagonally across the world:
+		double seconds = 0.0;
+		for (uint32_t b = 0; b < Blocks; ++b) {
+			glm::vec3 at = (Spacing * Side) * (float(b) / Blocks) * glm::vec3(1.0f, 0.0f, 1.0f);
+			Sound::listener.set_position_right(at, glm::vec3(1.0f, 0.0f, 0.0f), 0.02f);
+			seconds += mix_blocks(1);
+		}
+		seconds /= Blocks;
+		uint32_t far = Sound::stats().history.back().voices_far;
+		reset_voices();
+		if (far_radii == 0.0f) all_seconds = seconds;
+
+		std::cout << std::setw(10) << std::fixed << std::setprecision(0) << far_radii
+		          << std::setw(12) << std::setprecision(1) << seconds * 1e6
+		          << std::setw(10) << far
+		          << std::setw(9) << std::setprecision(1) << all_seconds / seconds << "x"
+		          << std::setw(11) << std::setprecision(1) << BLOCK_SECONDS / seconds << "x" << '\n';
+	}
+
+	settings.far_radii = Sound::Settings().far_radii;
+	Sound::init(settings);
+}
+
+//------------------------------------------------
+//ambisonic buses: 3D voices on a stereo bus vs. an ambisonic bus, with the listener still and spinning
+
+static void bench_ambisonic(Sound::Settings settings) {
+	constexpr uint32_t const Blocks = 200;
+
+	Sound::Sample sample(make_test_audio(AUDIO_RATE / 4 + 17));
+
+	std::cout << "\n--- ambisonic buses ---\n";
+	std::cout << std::setw(11) << "bus"
+	          << std::setw(10) << "listener"
+	          << std::setw(8) << "voices"
+	          << std::setw(12) << "us/block"
+	          << std::setw(18) << "ns/sample/voice"
+	          << std::setw(12) << "headroom" << '\n';
+
+	for (bool ambisonic : {false, true}) {
+		//(3D samples play through "sfx" by default)
+		settings.ambisonic_buses.clear();
+		if (ambisonic) settings.ambisonic_buses.emplace_back("sfx");
+		Sound::init(settings);
+		for (uint32_t voices : {64U, 1024U, 4096U}) {
+			for (bool spin : {false, true}) {
+				for (uint32_t v = 0; v < voices; ++v) {
+					float angle = 6.2831853f * float(v) / float(voices);
+					Sound::loop_3D(sample, 1.0f / voices, 5.0f * glm::vec3(std::cos(angle), std::sin(angle), 0.0f), 5.0f);
+				}
+				mix_blocks(10);
+
+				double seconds = 0.0;
+				float angle = 0.0f;
+				for (uint32_t b = 0; b < Blocks; ++b) {
+					if (spin) {
+						angle += 1.5f;
+						Sound::listener.set_position_right(glm::vec3(0.0f), glm::vec3(std::cos(angle), std::sin(angle), 0.0f), 4.0f * float(BLOCK_SECONDS));
+					}
+					seconds += mix_blocks(1);
+				}
+				reset_voices();
+				Sound::listener.set_position_right(glm::vec3(0.0f), glm::vec3(1.0f, 0.0f, 0.0f), 0.0f);
+				mix_blocks(1);
+
+				double block_seconds = seconds / Blocks;
+				std::cout << std::setw(11) << (ambisonic ? "ambisonic" : "stereo")
+				          << std::setw(10) << (spin ? "spinning" : "still")
+				          << std::setw(8) << voices
+				          << std::setw(12) << std::fixed << std::setprecision(1) << block_seconds * 1e6
+				          << std::setw(18) << std::setprecision(3) << block_seconds * 1e9 / (double(MIX_SAMPLES) * voices)
+				          << std::setw(11) << std::setprecision(1) << BLOCK_SECONDS / block_seconds << "x" << '\n';
+			}
+		}
+	}
+
+	settings.ambisonic_buses.clear();
+	Sound::init(settings);
+}
+
+//------------------------------------------------
+
+int main(int argc, char **argv) {
+	Sound::Settings settings;
+	settings.max_voices = 4096;
+	settings.max_real_voices = 4096;
+	settings.open_device = false;
+	settings.block_size = MIX_SAMPLES;
+	Sound::init(settings);
+
+	//run the benchmarks named on the command line (or all of them):
+	auto want = [&](char const *name) {
+		if (argc <= 1) return true;
+		for (int a = 1; a < argc; ++a) {
+			if (std::string(argv[a]) == name) return true;
+		}
+		return false;
+	};
+
+	if (want("voices")) bench_voice_counts();
+	if (want("rotation")) bench_listener_rotation();
+	if (want("rate")) bench_playback_rate();
+	if (want("blocks")) bench_block_sizes();
+	if (want("formats")) bench_sample_formats();
+	if (want("threads")) bench_mix_threads(settings);
+	if (want("reverb")) bench_reverb();
+	if (want("far")) bench_far_voices(settings);
+	if (want("ambisonic")) bench_ambisonic(settings);
+
+	Sound::shutdown();
+	return 0;
+}
@@ -0,0 +1,104 @@
+#include "ima_adpcm.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+//standard IMA-ADPCM tables:
+static int32_t const index_table[16] = {
+	-1, -1, -1, -1, 2, 4, 6, 8,
+	-1, -1, -1, -1, 2, 4, 6, 8,
+};
+
+static int32_t const step_table[89] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+	19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+	130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+	337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+	876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+	2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+	5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+	15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+//decoder state update shared by the encoder and decoder:
+static inline void step(uint8_t code, int32_t *predictor_, int32_t *index_) {
+	int32_t &predictor = *predictor_;
+	int32_t &index = *index_;
+	//(same as the usual step/8 + step/4 + ... sum, computed without branches):
+	int32_t diff = ((2 * (code & 7) + 1) * step_table[index]) >> 3;
+	predictor += (code & 8 ? -diff : diff);
+	predictor = std::max(-32768, std::min(32767, predictor));
+	index = std::max(0, std::min(88, index + index_table[code]));
+}
+
+void adpcm_encode(float const *samples, uint32_t count, std::vector< uint8_t > *blocks_) {
+	assert(blocks_);
+	auto &blocks = *blocks_;
+
+	uint32_t block_count = (count + ADPCM_BLOCK_SAMPLES - 1) / ADPCM_BLOCK_SAMPLES;
+	blocks.assign(block_count * ADPCM_BLOCK_BYTES, 0);
+
+	int32_t index = 0; //step index carries over from block to block
+	for (uint32_t b = 0; b < block_count; ++b) {
+		uint8_t *block = &blocks[b * ADPCM_BLOCK_BYTES];
+		uint32_t begin = b * ADPCM_BLOCK_SAMPLES;
+
+		auto quantize = [&](uint32_t s) -> int32_t {
+			if (s >= count) return 0; //pad the last block with silence
+			return int32_t(std::lround(std::max(-1.0f, std::min(1.0f, samples[s])) * 32767.0f));
+		};
+
+		int32_t predictor = quantize(begin);
+		block[0] = uint8_t(uint16_t(predictor) & 0xff);
+		block[1] = uint8_t(uint16_t(predictor) >> 8);
+		block[2] = uint8_t(index);
+		block[3] = 0;
+
+		for (uint32_t s = 0; s < ADPCM_BLOCK_SAMPLES; ++s) {
+			int32_t delta = quantize(begin + s) - predictor;
+			uint8_t code = 0;
+			if (delta < 0) {
+				code = 8;
+				delta = -delta;
+			}
+			int32_t step_size = step_table[index];
+			if (delta >= step_size) { code |= 4; delta -= step_size; }
+			step_size >>= 1;
+			if (delta >= step_size) { code |= 2; delta -= step_size; }
+			step_size >>= 1;
+			if (delta >= step_size) { code |= 1; }
+
+			step(code, &predictor, &index);
+
+			block[4 + s / 2] |= (s % 2 == 0 ? code : uint8_t(code << 4));
+		}
+	}
+}
+
+void adpcm_decode(std::vector< uint8_t > const &blocks, uint32_t begin, uint32_t count, float *out) {
+	assert(out || count == 0);
+	assert((begin + count + ADPCM_BLOCK_SAMPLES - 1) / ADPCM_BLOCK_SAMPLES * ADPCM_BLOCK_BYTES <= blocks.size());
+
+	uint32_t end = begin + count;
+	uint32_t b = begin / ADPCM_BLOCK_SAMPLES;
+	while (begin < end) {
+		uint8_t const *block = &blocks[b * ADPCM_BLOCK_BYTES];
+		int32_t predictor = int16_t(uint16_t(block[0]) | (uint16_t(block[1]) << 8));
+		int32_t index = block[2];
+
+		uint32_t block_begin = b * ADPCM_BLOCK_SAMPLES;
+		uint32_t block_end = std::min(end, block_begin + ADPCM_BLOCK_SAMPLES);
+		for (uint32_t s = block_begin; s < block_end; ++s) {
+			uint32_t at = s - block_begin;
+			uint8_t code = (block[4 + at / 2] >> (4 * (at % 2))) & 0xf;
+			step(code, &predictor, &index);
+			if (s >= begin) {
+				*(out++) = float(predictor) * (1.0f / 32767.0f);
+			}
+		}
+		begin = block_end;
+		++b;
+	}
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+//IMA-ADPCM compression, used to keep sample data resident at 4 bits per sample.
+//Data is stored in independent blocks so that decoding can start at any block:
+// |pr|ed|ix|..| <-- int16 predictor, uint8 step index, one byte of padding
+// |nn|nn|...|nn| <-- ADPCM_BLOCK_SAMPLES 4-bit codes (low nibble first)
+
+constexpr uint32_t const ADPCM_BLOCK_SAMPLES = 256;
+constexpr uint32_t const ADPCM_BLOCK_BYTES = 4 + ADPCM_BLOCK_SAMPLES / 2;
+
+//compress 'count' samples (range -1 to 1) into *blocks (replacing its contents):
+void adpcm_encode(float const *samples, uint32_t count, std::vector< uint8_t > *blocks);
+
+//decompress samples [begin, begin + count) into 'out' (range -1 to 1):
+void adpcm_decode(std::vector< uint8_t > const &blocks, uint32_t begin, uint32_t count, float *out);
@@ -1,4 +1,6 @@
 #include "load_opus.hpp"
+#include "pcm.hpp"
+#include "WorkerPool.hpp"
 
 #include <opusfile.h>
 
@@ -7,47 +9,202 @@
 #include <cmath>
 #include <stdexcept>
 #include <iostream>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <algorithm>
 
-void load_opus(std::string const &filename, std::vector< float > *data_) {
-	assert(data_);
-	auto &data = *data_;
-	data.clear();
+//files at least this long (in samples) are decoded in parallel, in ranges at least this long:
+static constexpr ogg_int64_t const PARALLEL_RANGE = 10 * 48000;
 
-	std::cout << "loading '" << filename << "'..."; std::cout.flush();
+//ranges after the first start decoding this far (in samples) before their first sample, and throw that audio away;
+// this is on top of the pre-roll op_pcm_seek() already does, so the decoder has fully settled by the start of the range:
+static constexpr ogg_int64_t const PREROLL = 3840; //(80ms)
 
-	//will hold opusfile * int a std::unique_ptr so that it will automatically be deleted:
+//helper: open an opus file from memory (so several decoders can share one copy of the file):
+static std::unique_ptr< OggOpusFile, decltype(&op_free) > open_opus(std::vector< unsigned char > const &file, std::string const &filename) {
 	int err = 0;
 	std::unique_ptr< OggOpusFile, decltype(&op_free) > op(
-		op_open_file(filename.c_str(), &err), //pointer to hold
+		op_open_memory(file.data(), file.size(), &err), //pointer to hold
 		op_free //deletion function
 	);
-	if (err != 0) {
+	if (err != 0 || !op) {
 		throw std::runtime_error("opusfile error " + std::to_string(err) + " opening \"" + filename + "\".");
 	}
+	return op;
+}
+
+//helper: decode samples [begin, end) of 'op' (downmixed to mono) into 'out':
+// returns the number of samples decoded (less than end - begin only if the file ends early)
+static ogg_int64_t decode_range(OggOpusFile *op, ogg_int64_t begin, ogg_int64_t end, float *out, std::string const &filename) {
+	if (begin > 0) {
+		int ret = op_pcm_seek(op, std::max< ogg_int64_t >(0, begin - PREROLL));
+		if (ret != 0) {
+			throw std::runtime_error("opusfile seek error " + std::to_string(ret) + " in \"" + filename + "\".");
+		}
+	}
+
+	std::vector< float > pcm(2*48000*2, 0.0f); //(see note in load_opus, below)
+	ogg_int64_t at = op_pcm_tell(op); //sample position of the next sample read
+	ogg_int64_t written = 0;
+	while (at < end) {
+		int ret = op_read_float_stereo(op, pcm.data(), int(pcm.size()));
+		if (ret < 0) {
+			throw std::runtime_error("opusfile read error " + std::to_string(ret) + " reading \"" + filename + "\".");
+		}
+		if (ret == 0) break; //end of file
+
+		//keep just the part of this read that falls in [begin, end):
+		ogg_int64_t first = std::max(at, begin);
+		ogg_int64_t last = std::min(at + ret, end);
+		if (last > first) {
+			pcm_downmix(pcm.data() + 2 * (first - at), 2, size_t(last - first), out + (first - begin)); //downmix to mono by averaging
+			written = last - begin;
+		}
+		at += ret;
+	}
+	return written;
+}
+
+//a long file being decoded in ranges (shared with the WorkerPool jobs helping decode it):
+struct OpusRanges {
+	std::shared_ptr< std::vector< unsigned char > const > file;
+	std::string filename;
+	std::vector< ogg_int64_t > begins; //range r is samples [begins[r], begins[r+1])
+	float *out = nullptr; //where the decoded file goes (only written by threads that claimed a range)
+	std::vector< ogg_int64_t > decoded; //samples decoded, per range
+	std::vector< std::exception_ptr > errors; //per range
+
+	std::atomic< uint32_t > next{1}; //next range to claim (range 0 is decoded by the loading thread, with the decoder it already has open)
+	std::mutex mutex; //guards 'finished'
+	std::condition_variable range_finished;
+	uint32_t finished = 0; //ranges (after the first) that are done
+
+	uint32_t ranges() const { return uint32_t(begins.size() - 1); }
+};
+
+//helper: decode range 'r' of 'state' (opening a decoder for it if 'op' is null), recording any error:
+static void decode_opus_range(OpusRanges &state, uint32_t r, OggOpusFile *op) {
+	try {
+		std::unique_ptr< OggOpusFile, decltype(&op_free) > own(nullptr, op_free);
+		if (!op) {
+			own = open_opus(*state.file, state.filename);
+			op = own.get();
+		}
+		state.decoded[r] = decode_range(op, state.begins[r], state.begins[r+1], state.out + state.begins[r], state.filename);
+	} catch (...) {
+		state.errors[r] = std::current_exception();
+	}
+}
+
+//helper: claim and decode ranges after the first until none are left:
+static void decode_claimed_opus_ranges(OpusRanges &state) {
+	while (true) {
+		uint32_t r = state.next.fetch_add(1);
+		if (r >= state.ranges()) return;
+		decode_opus_range(state, r, nullptr);
+		{
+			std::unique_lock< std::mutex > lock(state.mutex);
+			state.finished += 1;
+		}
+		state.range_finished.notify_all();
+	}
+}
+
+void load_opus(std::string const &filename, std::vector< float > *data_) {
+	assert(data_);
+	auto &data = *data_;
+	data.clear();
+
+	std::cout << "loading '" << filename << "'..."; std::cout.flush();
+
+	//read the whole (compressed) file, so that decoders on several threads can share it:
+	std::shared_ptr< std::vector< unsigned char > > file = std::make_shared< std::vector< unsigned char > >();
+	{
+		std::ifstream in(filename, std::ios::binary);
+		if (!in) throw std::runtime_error("Failed to open \"" + filename + "\".");
+		file->assign(std::istreambuf_iterator< char >(in), std::istreambuf_iterator< char >());
+	}
+
+	//will hold opusfile * int a std::unique_ptr so that it will automatically be deleted:
+	std::unique_ptr< OggOpusFile, decltype(&op_free) > op = open_opus(*file, filename);
 
 	//get length in samples:
 	ogg_int64_t length = op_pcm_total(op.get(), -1);
+
+	//long files are split into ranges, each decoded (with its own decoder) straight into 'data':
+	// ranges after the first are offered to the shared WorkerPool, and this thread decodes any that no worker has started --
+	// so loads running at the same time share the pool's threads (rather than each starting a thread per core),
+	// and a load that is itself a WorkerPool job (e.g., from load_async) never waits on a job queued behind it
+	uint32_t threads = std::max(1U, std::thread::hardware_concurrency());
+	uint32_t ranges = (length >= 0 ? uint32_t(std::min< ogg_int64_t >(threads, length / PARALLEL_RANGE)) : 0);
+	if (ranges >= 2) {
+		data.assign(size_t(length), 0.0f);
+
+		std::shared_ptr< OpusRanges > state = std::make_shared< OpusRanges >();
+		state->file = file;
+		state->filename = filename;
+		state->begins.resize(ranges + 1);
+		for (uint32_t r = 0; r <= ranges; ++r) {
+			state->begins[r] = length * r / ranges;
+		}
+		state->out = data.data();
+		state->decoded.assign(ranges, 0);
+		state->errors.resize(ranges);
+
+		//(jobs hold 'state', since one may only start -- and find nothing left to claim -- after this load is done)
+		for (uint32_t r = 1; r < ranges; ++r) {
+			WorkerPool::shared().run([state](){ decode_claimed_opus_ranges(*state); });
+		}
+		decode_opus_range(*state, 0, op.get());
+		decode_claimed_opus_ranges(*state);
+		{ //wait for ranges claimed by workers:
+			std::unique_lock< std::mutex > lock(state->mutex);
+			state->range_finished.wait(lock, [&](){ return state->finished == ranges - 1; });
+		}
+
+		for (auto const &error : state->errors) {
+			if (error) std::rethrow_exception(error);
+		}
+		//every range but the last should be complete; if the last came up short, the length estimate was off:
+		std::vector< ogg_int64_t > const &begins = state->begins;
+		std::vector< ogg_int64_t > const &decoded = state->decoded;
+		for (uint32_t r = 0; r + 1 < ranges; ++r) {
+			if (decoded[r] != begins[r+1] - begins[r]) {
+				throw std::runtime_error("opusfile decoded too few samples in the middle of \"" + filename + "\".");
+			}
+		}
+		data.resize(size_t(begins[ranges-1] + decoded[ranges-1]));
+
+		std::cout << " done (" << ranges << " ranges)." << std::endl;
+		return;
+	}
+
 	if (length >= 0) {
-		data.reserve(length);
-	} else {
-		std::cerr << "WARNING: cannot estimate length of '" << filename << "', loading may be slow." << std::endl;
-		length = 0;
-		data.reserve(2*48000);
+		//shorter files are decoded on this thread, still straight into 'data':
+		data.assign(size_t(length), 0.0f);
+		data.resize(size_t(decode_range(op.get(), 0, length, data.data(), filename)));
+		std::cout << " done." << std::endl;
+		return;
 	}
 
+	std::cerr << "WARNING: cannot estimate length of '" << filename << "', loading may be slow." << std::endl;
+	data.reserve(2*48000);
+
 	std::vector< float > pcm(2*48000*2, 0.0f); //seems like reads are generally 960 samples so this is definitely overkill
 	for (;;) {
 		int ret = op_read_float_stereo(op.get(), pcm.data(), int(pcm.size()));
-		if (ret >= 0) {
-			//positive return values are the number of samples read per channel; copy into data:
-			data.reserve(data.size() + ret);
-			for (uint32_t i = 0; i < uint32_t(ret); ++i) {
-				data.emplace_back((pcm[2*i] + pcm[2*i+1]) * 0.5f); //downmix to mono by averaging
-			}
-			if (ret == 0) break;
-		} else {
+		if (ret < 0) {
 			throw std::runtime_error("opusfile read error " + std::to_string(ret) + " reading \"" + filename + "\".");
 		}
+		if (ret == 0) break;
+		//positive return values are the number of samples read per channel; downmix onto the end of data:
+		size_t at = data.size();
+		data.resize(at + size_t(ret));
+		pcm_downmix(pcm.data(), 2, size_t(ret), data.data() + at);
 	}
 
 	std::cout << " done." << std::endl;
@@ -1,8 +1,12 @@
 #include "load_wav.hpp"
+#include "resample.hpp"
+#include "pcm.hpp"
 
 #include <SDL.h>
 
 #include <iostream>
+#include <fstream>
+#include <cstring>
 #include <cassert>
 #include <algorithm>
 
@@ -21,11 +25,22 @@ void load_wav(std::string const &filename, std::vector< float > *data_) {
 		throw std::runtime_error("Failed to load WAV file '" + filename + "'; SDL says \"" + std::string(SDL_GetError()) + "\"");
 	}
 
-	//based on the SDL_AudioCVT example in the docs: https://wiki.libsdl.org/SDL_AudioCVT
-	SDL_AudioCVT cvt;
-	SDL_BuildAudioCVT(&cvt, have->format, have->channels, have->freq, AUDIO_F32SYS, 1, AUDIO_RATE);
-	if (cvt.needed) {
+	if (have->format != AUDIO_F32SYS || have->channels != 1 || have->freq != int(AUDIO_RATE)) {
 		std::cout << "WAV file '" + filename + "' didn't load as " + std::to_string(AUDIO_RATE) + " Hz, float32, mono; converting." << std::endl;
+	}
+
+	uint32_t channels = have->channels;
+	SDL_AudioFormat format = have->format;
+	Uint8 const *buf = audio_buf;
+	Uint32 len = audio_len;
+
+	//int16, int32 (and 24-bit, which SDL widens to int32), and float32 audio is converted to float32 mono by the kernels in pcm.hpp;
+	// anything else is first converted to float32 by SDL (keeping the channels and rate -- the rate is converted below, with a better filter than SDL's);
+	// based on the SDL_AudioCVT example in the docs: https://wiki.libsdl.org/SDL_AudioCVT
+	SDL_AudioCVT cvt;
+	cvt.buf = nullptr;
+	if (format != AUDIO_S16SYS && format != AUDIO_S32SYS && format != AUDIO_F32SYS) {
+		SDL_BuildAudioCVT(&cvt, format, have->channels, have->freq, AUDIO_F32SYS, have->channels, have->freq);
 		cvt.len = audio_len;
 		cvt.buf = (Uint8 *)SDL_malloc(cvt.len * cvt.len_mult);
 		SDL_memcpy(cvt.buf, audio_buf, audio_len);
@@ -33,18 +48,85 @@ void load_wav(std::string const &filename, std::vector< float > *data_) {
 		int final_size = cvt.len_cvt;
 		assert(final_size >= 0 && final_size <= cvt.len * cvt.len_mult && "Converted audio should fit in buffer.");
 		assert(final_size % 4 == 0 && "Converted audio should consist of 4-byte elements.");
-		data.assign(reinterpret_cast< float * >(cvt.buf), reinterpret_cast< float * >(cvt.buf + final_size));
-		SDL_free(cvt.buf);
+		format = AUDIO_F32SYS;
+		buf = cvt.buf;
+		len = Uint32(final_size);
+	}
+
+	size_t frames = len / ((SDL_AUDIO_BITSIZE(format) / 8) * channels);
+	data.resize(frames);
+	if (format == AUDIO_F32SYS) {
+		pcm_downmix(reinterpret_cast< float const * >(buf), channels, frames, data.data());
 	} else {
-		data.assign(reinterpret_cast< float * >(audio_buf), reinterpret_cast< float * >(audio_buf + audio_len));
+		//integer audio is converted a chunk at a time, then downmixed straight into 'data':
+		constexpr size_t const ChunkFrames = 4096;
+		std::vector< float > chunk(ChunkFrames * channels);
+		for (size_t f = 0; f < frames; f += ChunkFrames) {
+			size_t count = std::min(ChunkFrames, frames - f);
+			if (format == AUDIO_S16SYS) {
+				pcm_from_s16(reinterpret_cast< int16_t const * >(buf) + f * channels, count * channels, chunk.data());
+			} else {
+				pcm_from_s32(reinterpret_cast< int32_t const * >(buf) + f * channels, count * channels, chunk.data());
+			}
+			pcm_downmix(chunk.data(), channels, count, data.data() + f);
+		}
 	}
+	if (cvt.buf) SDL_free(cvt.buf);
 	SDL_FreeWAV(audio_buf);
 
-	float min = 0.0f;
-	float max = 0.0f;
-	for (auto d : data) {
-		min = std::min(min, d);
-		max = std::max(max, d);
+	if (have->freq != int(AUDIO_RATE)) {
+		std::vector< float > converted;
+		resample(data, uint32_t(have->freq), AUDIO_RATE, &converted);
+		data = std::move(converted);
+	}
+
+	PCMLevels levels = pcm_levels(data.data(), data.size());
+	std::cout << "Range: " << levels.min << ", " << levels.max << " (rms " << levels.rms << ")" << std::endl;
+}
+
+void save_wav(std::string const &filename, std::vector< float > const &data, uint32_t channels) {
+	assert(channels > 0 && data.size() % channels == 0);
+
+	std::ofstream out(filename, std::ios::binary);
+	if (!out) {
+		throw std::runtime_error("Failed to open WAV file '" + filename + "' for writing.");
+	}
+
+	//WAV files are little-endian:
+	auto u32 = [&out](uint32_t v) {
+		char bytes[4] = { char(v & 0xff), char((v >> 8) & 0xff), char((v >> 16) & 0xff), char((v >> 24) & 0xff) };
+		out.write(bytes, 4);
+	};
+	auto u16 = [&out](uint16_t v) {
+		char bytes[2] = { char(v & 0xff), char((v >> 8) & 0xff) };
+		out.write(bytes, 2);
+	};
+
+	uint32_t data_bytes = uint32_t(data.size() * 4);
+	out.write("RIFF", 4); u32(4 + (8 + 18) + (8 + 4) + (8 + data_bytes));
+	out.write("WAVE", 4);
+
+	out.write("fmt ", 4); u32(18);
+	u16(3); //WAVE_FORMAT_IEEE_FLOAT
+	u16(uint16_t(channels));
+	u32(AUDIO_RATE);
+	u32(AUDIO_RATE * channels * 4); //bytes per second
+	u16(uint16_t(channels * 4)); //bytes per frame
+	u16(32); //bits per sample
+	u16(0); //no extra format bytes
+
+	out.write("fact", 4); u32(4);
+	u32(uint32_t(data.size() / channels)); //frames
+
+	out.write("data", 4); u32(data_bytes);
+	for (float f : data) {
+		uint32_t bits;
+		static_assert(sizeof(bits) == sizeof(f), "float is 32 bits");
+		std::memcpy(&bits, &f, 4);
+		u32(bits);
+	}
+
+	if (!out) {
+		throw std::runtime_error("Failed to write WAV file '" + filename + "'.");
 	}
-	std::cout << "Range: " << min << ", " << max << std::endl;
 }
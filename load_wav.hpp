@@ -5,3 +5,6 @@
 
 //Load a WAV file as 48kHz floating-point mono; throws on error:
 void load_wav(std::string const &filename, std::vector< float > *data);
+
+//Save 48kHz floating-point audio ('channels' channels, interleaved) as a WAV file; throws on error:
+void save_wav(std::string const &filename, std::vector< float > const &data, uint32_t channels);
@@ -106,7 +106,10 @@ int main(int argc, char **argv) {
 	//SDL_ShowCursor(SDL_DISABLE);
 
 	//------------ init sound --------------
-	Sound::init();
+	Sound::Settings sound_settings;
+	//set SOUND_CAPTURE to record this session's sound commands to a file (replay them with 'replay-sound'):
+	if (char const *capture_file = SDL_getenv("SOUND_CAPTURE")) sound_settings.capture_file = capture_file;
+	Sound::init(sound_settings);
 
 	//------------ load assets --------------
 	call_load_functions();
@@ -0,0 +1,151 @@
+#include "pcm.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PCM_SSE
+#endif
+
+void pcm_from_s16(int16_t const *in, size_t count, float *out, float scale) {
+	size_t i = 0;
+#ifdef PCM_SSE
+	__m128 vscale = _mm_set1_ps(scale);
+	for (; i + 8 <= count; i += 8) {
+		__m128i s = _mm_loadu_si128(reinterpret_cast< __m128i const * >(in + i));
+		//(sign-extend by putting each sample in the top half of a 32-bit lane, then shifting down)
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), vscale));
+		_mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), vscale));
+	}
+#endif
+	for (; i < count; ++i) {
+		out[i] = float(in[i]) * scale;
+	}
+}
+
+void pcm_from_s32(int32_t const *in, size_t count, float *out) {
+	float const scale = 1.0f / 2147483648.0f;
+	size_t i = 0;
+#ifdef PCM_SSE
+	__m128 vscale = _mm_set1_ps(scale);
+	for (; i + 4 <= count; i += 4) {
+		__m128i s = _mm_loadu_si128(reinterpret_cast< __m128i const * >(in + i));
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(s), vscale));
+	}
+#endif
+	for (; i < count; ++i) {
+		out[i] = float(in[i]) * scale;
+	}
+}
+
+void pcm_to_s16(float const *in, size_t count, int16_t *out) {
+	size_t i = 0;
+#ifdef PCM_SSE
+	//(_mm_cvtps_epi32 rounds to nearest, ties to even -- same as std::nearbyint, below)
+	__m128 lo = _mm_set1_ps(-1.0f), hi = _mm_set1_ps(1.0f), scale = _mm_set1_ps(32767.0f);
+	for (; i + 8 <= count; i += 8) {
+		__m128 a = _mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), lo), hi), scale);
+		__m128 b = _mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 4), lo), hi), scale);
+		__m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+		_mm_storeu_si128(reinterpret_cast< __m128i * >(out + i), packed);
+	}
+#endif
+	for (; i < count; ++i) {
+		out[i] = int16_t(std::nearbyint(std::max(-1.0f, std::min(1.0f, in[i])) * 32767.0f));
+	}
+}
+
+void pcm_downmix(float const *in, uint32_t channels, size_t frames, float *out) {
+	if (channels == 1) {
+		if (out != in) std::memmove(out, in, frames * sizeof(float));
+		return;
+	}
+
+	size_t f = 0;
+	if (channels == 2) {
+#ifdef PCM_SSE
+		//(every iteration reads its input before writing, and writes behind where the next one reads, so in-place works)
+		__m128 half = _mm_set1_ps(0.5f);
+		for (; f + 4 <= frames; f += 4) {
+			__m128 a = _mm_loadu_ps(in + 2 * f);
+			__m128 b = _mm_loadu_ps(in + 2 * f + 4);
+			__m128 left = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+			__m128 right = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+			_mm_storeu_ps(out + f, _mm_mul_ps(_mm_add_ps(left, right), half));
+		}
+#endif
+		for (; f < frames; ++f) {
+			out[f] = (in[2 * f] + in[2 * f + 1]) * 0.5f;
+		}
+		return;
+	}
+
+	float const scale = 1.0f / float(channels);
+	for (; f < frames; ++f) {
+		float const *frame = in + f * channels;
+		float sum = 0.0f;
+		for (uint32_t c = 0; c < channels; ++c) {
+			sum += frame[c];
+		}
+		out[f] = sum * scale;
+	}
+}
+
+void pcm_gain(float *samples, size_t count, float gain) {
+	size_t i = 0;
+#ifdef PCM_SSE
+	__m128 vgain = _mm_set1_ps(gain);
+	for (; i + 4 <= count; i += 4) {
+		_mm_storeu_ps(samples + i, _mm_mul_ps(_mm_loadu_ps(samples + i), vgain));
+	}
+#endif
+	for (; i < count; ++i) {
+		samples[i] *= gain;
+	}
+}
+
+PCMLevels pcm_levels(float const *samples, size_t count) {
+	PCMLevels levels;
+	if (count == 0) return levels;
+
+	//sums of squares are gathered in floats a run at a time, then added up in a double (so long files don't lose precision):
+	constexpr size_t const Run = 4096;
+	double sum_squares = 0.0;
+	float min = 0.0f, max = 0.0f;
+	for (size_t begin = 0; begin < count; begin += Run) {
+		size_t end = std::min(count, begin + Run);
+		size_t i = begin;
+		float run_squares = 0.0f;
+#ifdef PCM_SSE
+		__m128 vmin = _mm_setzero_ps(), vmax = _mm_setzero_ps(), vsquares = _mm_setzero_ps();
+		for (; i + 4 <= end; i += 4) {
+			__m128 s = _mm_loadu_ps(samples + i);
+			vmin = _mm_min_ps(vmin, s);
+			vmax = _mm_max_ps(vmax, s);
+			vsquares = _mm_add_ps(vsquares, _mm_mul_ps(s, s));
+		}
+		float lanes[4];
+		_mm_storeu_ps(lanes, vmin);
+		min = std::min({min, lanes[0], lanes[1], lanes[2], lanes[3]});
+		_mm_storeu_ps(lanes, vmax);
+		max = std::max({max, lanes[0], lanes[1], lanes[2], lanes[3]});
+		_mm_storeu_ps(lanes, vsquares);
+		run_squares = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+		for (; i < end; ++i) {
+			min = std::min(min, samples[i]);
+			max = std::max(max, samples[i]);
+			run_squares += samples[i] * samples[i];
+		}
+		sum_squares += double(run_squares);
+	}
+
+	levels.min = min;
+	levels.max = max;
+	levels.rms = float(std::sqrt(sum_squares / double(count)));
+	return levels;
+}
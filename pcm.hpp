@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+//PCM conversion and scanning kernels, used by the loaders (load_wav, load_opus) and by Sound::Sample::compress.
+//Each kernel writes straight into storage the caller has already sized, and uses SSE on x86-64.
+//Integer samples convert to floats in [-1, 1) by dividing by their full scale (e.g., 32768 for int16).
+
+//convert 'count' int16 samples to floats, multiplying by 'scale':
+// (the default is the full-scale conversion above; Sound::Sample uses 1.0f / 32767.0f to undo pcm_to_s16 exactly)
+void pcm_from_s16(int16_t const *in, size_t count, float *out, float scale = 1.0f / 32768.0f);
+
+//convert 'count' int32 samples to floats:
+// (SDL_LoadWAV widens 24-bit WAV files to int32 samples, so those end up here too)
+void pcm_from_s32(int32_t const *in, size_t count, float *out);
+
+//convert 'count' floats (clamped to [-1, 1]) to int16 samples, rounding to nearest:
+void pcm_to_s16(float const *in, size_t count, int16_t *out);
+
+//average 'frames' frames of 'channels' interleaved channels down to mono:
+// ('out' may be the same as 'in'; one and two channels are vectorized, more channels are not)
+void pcm_downmix(float const *in, uint32_t channels, size_t frames, float *out);
+
+//multiply 'count' samples by 'gain', in place:
+void pcm_gain(float *samples, size_t count, float gain);
+
+//range and loudness of 'count' samples:
+struct PCMLevels {
+	float min = 0.0f; //(min and max include zero, so are 0 for silence)
+	float max = 0.0f;
+	float rms = 0.0f; //root-mean-square level
+	float peak() const { return (-min > max ? -min : max); }
+};
+PCMLevels pcm_levels(float const *samples, size_t count);
@@ -0,0 +1,207 @@
+#include "pcm_cache.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <thread>
+#include <cstring>
+#include <cassert>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+	std::string cache_directory;
+
+	//cached files start with this header; the audio (as floats) follows right after:
+	struct Header {
+		char magic[8]; //"pcmcache"
+		uint32_t version; //format version (see VERSION, below)
+		uint32_t rate; //always 48000
+		uint64_t source_size; //size of the source file in bytes
+		int64_t source_mtime; //modification time of the source file (in std::filesystem::file_time_type ticks)
+		uint64_t source_hash; //FNV-1a hash of the source file's contents
+		uint32_t length; //number of samples
+		uint8_t padding[20]; //(keeps the audio 64-byte aligned)
+	};
+	static_assert(sizeof(Header) == 64, "Header is packed.");
+
+	constexpr char const MAGIC[8] = {'p','c','m','c','a','c','h','e'};
+	constexpr uint32_t const VERSION = 1;
+
+	//helper: 64-bit FNV-1a hash:
+	uint64_t fnv1a(uint8_t const *bytes, size_t count, uint64_t hash = 0xcbf29ce484222325ULL) {
+		for (size_t i = 0; i < count; ++i) {
+			hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+		}
+		return hash;
+	}
+
+	//helper: fill in the source_* fields of 'header' from the file 'source'; returns false if the file can't be read:
+	bool describe_source(std::string const &source, Header *header) {
+		std::error_code error;
+		uint64_t size = std::filesystem::file_size(source, error);
+		if (error) return false;
+		auto mtime = std::filesystem::last_write_time(source, error);
+		if (error) return false;
+
+		std::ifstream in(source, std::ios::binary);
+		if (!in) return false;
+		uint64_t hash = fnv1a(nullptr, 0);
+		std::vector< char > buffer(1 << 16);
+		while (in) {
+			in.read(buffer.data(), buffer.size());
+			hash = fnv1a(reinterpret_cast< uint8_t const * >(buffer.data()), size_t(in.gcount()), hash);
+		}
+
+		header->source_size = size;
+		header->source_mtime = int64_t(mtime.time_since_epoch().count());
+		header->source_hash = hash;
+		return true;
+	}
+
+	//helper: name of the cached file for 'source' (e.g., "music-0123456789abcdef.pcm"):
+	// (includes a hash of the full path, so same-named files in different directories don't collide)
+	std::string cache_filename(std::string const &source) {
+		std::error_code error;
+		std::filesystem::path path = std::filesystem::absolute(source, error);
+		if (!error) path = std::filesystem::weakly_canonical(path, error);
+		std::string full = (error ? source : path.string());
+
+		std::ostringstream name;
+		name << std::filesystem::path(source).stem().string() << '-'
+		     << std::hex << std::setw(16) << std::setfill('0') << fnv1a(reinterpret_cast< uint8_t const * >(full.data()), full.size())
+		     << ".pcm";
+		return (std::filesystem::path(cache_directory) / name.str()).string();
+	}
+
+	//helper: memory-map a whole file read-only (returns nullptr on failure):
+	std::shared_ptr< uint8_t const > map_file(std::string const &filename, size_t *size_) {
+		assert(size_);
+		auto &size = *size_;
+	#if defined(_WIN32)
+		HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE) return nullptr;
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+			CloseHandle(file);
+			return nullptr;
+		}
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		CloseHandle(file);
+		if (mapping == NULL) return nullptr;
+		void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping); //(the view keeps the mapping open)
+		if (view == NULL) return nullptr;
+		size = size_t(file_size.QuadPart);
+		return std::shared_ptr< uint8_t const >(reinterpret_cast< uint8_t const * >(view), [](uint8_t const *view) {
+			UnmapViewOfFile(view);
+		});
+	#else
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0) return nullptr;
+		struct stat info;
+		if (fstat(fd, &info) != 0 || info.st_size == 0) {
+			close(fd);
+			return nullptr;
+		}
+		void *base = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd); //(the mapping keeps the file open)
+		if (base == MAP_FAILED) return nullptr;
+		size_t mapped = size_t(info.st_size);
+		size = mapped;
+		return std::shared_ptr< uint8_t const >(reinterpret_cast< uint8_t const * >(base), [mapped](uint8_t const *base) {
+			munmap(const_cast< uint8_t * >(base), mapped);
+		});
+	#endif
+	}
+}
+
+void set_pcm_cache_directory(std::string const &directory) {
+	cache_directory = directory;
+	if (cache_directory != "") {
+		std::error_code error;
+		std::filesystem::create_directories(cache_directory, error);
+		if (error) {
+			std::cerr << "WARNING: failed to create PCM cache directory '" << cache_directory << "' (" << error.message() << "); decoded audio won't be cached." << std::endl;
+			cache_directory = "";
+		}
+	}
+}
+
+bool load_pcm_cache(std::string const &source, std::shared_ptr< float const > *pcm, uint32_t *length) {
+	assert(pcm);
+	assert(length);
+	if (cache_directory == "") return false;
+
+	Header expected;
+	if (!describe_source(source, &expected)) return false;
+
+	size_t size = 0;
+	std::shared_ptr< uint8_t const > file = map_file(cache_filename(source), &size);
+	if (!file) return false; //(not cached yet)
+
+	Header header;
+	if (size < sizeof(Header)) return false;
+	std::memcpy(&header, file.get(), sizeof(Header));
+	if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0
+	 || header.version != VERSION
+	 || header.rate != 48000
+	 || header.source_size != expected.source_size
+	 || header.source_mtime != expected.source_mtime
+	 || header.source_hash != expected.source_hash
+	 || size != sizeof(Header) + size_t(header.length) * sizeof(float)) {
+		return false; //(out of date)
+	}
+
+	//point at the audio, sharing ownership of the mapping:
+	*pcm = std::shared_ptr< float const >(file, reinterpret_cast< float const * >(file.get() + sizeof(Header)));
+	*length = header.length;
+	return true;
+}
+
+void save_pcm_cache(std::string const &source, std::vector< float > const &pcm) {
+	if (cache_directory == "") return;
+
+	Header header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.rate = 48000;
+	header.length = uint32_t(pcm.size());
+	if (!describe_source(source, &header)) {
+		std::cerr << "WARNING: can't read '" << source << "' to cache its decoded audio." << std::endl;
+		return;
+	}
+
+	//write to a temporary file then rename it into place, so a half-written file is never mapped:
+	// (the temporary name includes the thread, since samples may be loading on several threads)
+	std::string filename = cache_filename(source);
+	std::string temporary = filename + "." + std::to_string(std::hash< std::thread::id >()(std::this_thread::get_id())) + ".tmp";
+	{
+		std::ofstream out(temporary, std::ios::binary);
+		out.write(reinterpret_cast< char const * >(&header), sizeof(header));
+		out.write(reinterpret_cast< char const * >(pcm.data()), pcm.size() * sizeof(float));
+		if (!out) {
+			std::cerr << "WARNING: failed to write PCM cache file '" << temporary << "'." << std::endl;
+			out.close();
+			std::error_code error;
+			std::filesystem::remove(temporary, error);
+			return;
+		}
+	}
+	std::error_code error;
+	std::filesystem::rename(temporary, filename, error);
+	if (error) {
+		std::cerr << "WARNING: failed to move PCM cache file into place as '" << filename << "' (" << error.message() << ")." << std::endl;
+		std::filesystem::remove(temporary, error);
+	}
+}
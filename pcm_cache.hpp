@@ -0,0 +1,28 @@
+#pragma once
+
+/*
+ * The PCM cache stores decoded (48kHz, mono, float) audio on disk, so slow-to-decode files (e.g., '.opus' music)
+ * only need to be decoded once; later loads memory-map the cached audio instead.
+ *
+ * Cached files start with a header recording the source file's size, modification time, and content hash;
+ * if any of these don't match, the cached file is ignored (and replaced when the source is next decoded).
+ *
+ * The cache is opt-in (see Sound::Settings::pcm_cache_directory); failing to read or write it only warns.
+ *
+ */
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+//set the directory for cached files ("", the default, turns the cache off):
+// (only call when nothing is loading)
+void set_pcm_cache_directory(std::string const &directory);
+
+//look up decoded audio for the file 'source'; if found, memory-maps it into 'pcm' and returns true:
+// ('pcm' keeps the file mapped as long as it -- or any copy of it -- is alive)
+bool load_pcm_cache(std::string const &source, std::shared_ptr< float const > *pcm, uint32_t *length);
+
+//store decoded audio for the file 'source':
+void save_pcm_cache(std::string const &source, std::vector< float > const &pcm);
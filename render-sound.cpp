@@ -0,0 +1,259 @@
+//render-sound: renders a scripted sequence of sound events to a '.wav' file using the offline mixer.
+// no audio device is needed, so this runs as fast as the mixer can go (and works on headless machines).
+//
+//usage: render-sound <script.txt> [out.wav]
+//
+//script format (one command per line; '#' starts a comment):
+//  length <seconds>                                   -- length of output (default: just past the last event)
+//  sample <name> <file.wav|file.opus> [float|int16|adpcm]
+//  <time> play <id> <sample> <volume> <pan>
+//  <time> loop <id> <sample> <volume> <pan>
+//  <time> play_3D <id> <sample> <volume> <x> <y> <z> <half_volume_radius>
+//  <time> loop_3D <id> <sample> <volume> <x> <y> <z> <half_volume_radius>
+//  <time> set_volume <id> <volume> <ramp>
+//  <time> set_pan <id> <pan> <ramp>
+//  <time> set_position <id> <x> <y> <z> <ramp>
+//  <time> stop <id> <ramp>
+//  <time> listener <x> <y> <z> <right_x> <right_y> <right_z> <ramp>
+//  <time> volume <volume> <ramp>
+//
+//(samples start at exactly their event's time -- see Sound::play_at -- and other events take effect
+// at the start of the mixer block their time falls in)
+
+#include "Sound.hpp"
+#include "load_wav.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <functional>
+#include <algorithm>
+#include <memory>
+#include <map>
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+	//when compiled on windows, unhandled exceptions don't have their message printed, which can make debugging simple issues difficult.
+	try {
+#endif
+
+	if (argc != 2 && argc != 3) {
+		std::cerr << "Usage:\n\t" << argv[0] << " <script.txt> [out.wav]" << std::endl;
+		return 1;
+	}
+	std::string script_file = argv[1];
+	std::string wav_file = (argc == 3 ? argv[2] : "");
+
+	Sound::Settings settings;
+	settings.open_device = false;
+	Sound::init(settings);
+
+	//------------ parse script ------------
+
+	//(samples are loaded through a cache, so names that refer to the same file share data)
+	Sound::SampleCache cache;
+	std::map< std::string, Sound::SampleCache::Handle > samples;
+	std::map< std::string, Sound::PlayingSample > playing;
+
+	struct Event {
+		float time;
+		uint32_t line;
+		std::function< void() > run;
+	};
+	std::vector< Event > events;
+	float length = -1.0f;
+
+	{
+		std::ifstream in(script_file);
+		if (!in) throw std::runtime_error("Failed to open script '" + script_file + "'.");
+
+		std::string line;
+		uint32_t line_number = 0;
+		while (std::getline(in, line)) {
+			line_number += 1;
+			if (line.find('#') != std::string::npos) line = line.substr(0, line.find('#'));
+
+			std::istringstream str(line);
+			std::string first;
+			if (!(str >> first)) continue; //blank line
+
+			auto fail = [&](std::string const &what) {
+				throw std::runtime_error(script_file + ":" + std::to_string(line_number) + ": " + what);
+			};
+			auto get_sample = [&](std::string const &name) -> Sound::Sample const & {
+				auto f = samples.find(name);
+				if (f == samples.end()) fail("Unknown sample '" + name + "'.");
+				return *f->second;
+			};
+
+			if (first == "length") {
+				if (!(str >> length) || length < 0.0f) fail("Expected 'length <seconds>'.");
+			} else if (first == "sample") {
+				std::string name, file, format_name = "float";
+				if (!(str >> name >> file)) fail("Expected 'sample <name> <file> [format]'.");
+				str >> format_name;
+				Sound::Sample::Format format;
+				if (format_name == "float") format = Sound::Sample::Float32;
+				else if (format_name == "int16") format = Sound::Sample::Int16;
+				else if (format_name == "adpcm") format = Sound::Sample::ADPCM;
+				else fail("Unknown sample format '" + format_name + "'.");
+				samples[name] = cache.get(file, format);
+			} else {
+				Event event;
+				event.line = line_number;
+				try {
+					event.time = std::stof(first);
+				} catch (std::exception &) {
+					fail("Unknown command '" + first + "'.");
+				}
+				std::string command, id;
+				if (!(str >> command)) fail("Expected a command after time.");
+
+				if (command == "play" || command == "loop") {
+					std::string sample_name;
+					float volume, pan;
+					if (!(str >> id >> sample_name >> volume >> pan)) fail("Expected '" + command + " <id> <sample> <volume> <pan>'.");
+					Sound::Sample const *sample = &get_sample(sample_name);
+					bool loop = (command == "loop");
+					double time = event.time;
+					event.run = [&playing, id, sample, time, volume, pan, loop]() {
+						playing[id] = (loop ? Sound::loop_at(*sample, time, volume, pan) : Sound::play_at(*sample, time, volume, pan));
+					};
+				} else if (command == "play_3D" || command == "loop_3D") {
+					std::string sample_name;
+					float volume, radius;
+					glm::vec3 position;
+					if (!(str >> id >> sample_name >> volume >> position.x >> position.y >> position.z >> radius)) {
+						fail("Expected '" + command + " <id> <sample> <volume> <x> <y> <z> <half_volume_radius>'.");
+					}
+					Sound::Sample const *sample = &get_sample(sample_name);
+					bool loop = (command == "loop_3D");
+					double time = event.time;
+					event.run = [&playing, id, sample, time, volume, position, radius, loop]() {
+						playing[id] = (loop ? Sound::loop_3D_at(*sample, time, volume, position, radius) : Sound::play_3D_at(*sample, time, volume, position, radius));
+					};
+				} else if (command == "set_volume" || command == "set_pan") {
+					float value, ramp;
+					if (!(str >> id >> value >> ramp)) fail("Expected '" + command + " <id> <value> <ramp>'.");
+					bool pan = (command == "set_pan");
+					event.run = [&playing, id, value, ramp, pan]() {
+						if (pan) playing[id].set_pan(value, ramp);
+						else playing[id].set_volume(value, ramp);
+					};
+				} else if (command == "set_position") {
+					glm::vec3 position;
+					float ramp;
+					if (!(str >> id >> position.x >> position.y >> position.z >> ramp)) fail("Expected 'set_position <id> <x> <y> <z> <ramp>'.");
+					event.run = [&playing, id, position, ramp]() {
+						playing[id].set_position(position, ramp);
+					};
+				} else if (command == "stop") {
+					float ramp;
+					if (!(str >> id >> ramp)) fail("Expected 'stop <id> <ramp>'.");
+					event.run = [&playing, id, ramp]() {
+						playing[id].stop(ramp);
+					};
+				} else if (command == "listener") {
+					glm::vec3 position, right;
+					float ramp;
+					if (!(str >> position.x >> position.y >> position.z >> right.x >> right.y >> right.z >> ramp)) {
+						fail("Expected 'listener <x> <y> <z> <right_x> <right_y> <right_z> <ramp>'.");
+					}
+					event.run = [position, right, ramp]() {
+						Sound::listener.set_position_right(position, right, ramp);
+					};
+				} else if (command == "volume") {
+					float value, ramp;
+					if (!(str >> value >> ramp)) fail("Expected 'volume <volume> <ramp>'.");
+					event.run = [value, ramp]() {
+						Sound::set_volume(value, ramp);
+					};
+				} else {
+					fail("Unknown command '" + command + "'.");
+				}
+
+				std::string extra;
+				if (str >> extra) fail("Unexpected '" + extra + "' at end of line.");
+
+				events.emplace_back(std::move(event));
+			}
+		}
+	}
+
+	std::stable_sort(events.begin(), events.end(), [](Event const &a, Event const &b) {
+		return a.time < b.time;
+	});
+
+	if (length < 0.0f) {
+		length = (events.empty() ? 0.0f : events.back().time) + 1.0f;
+	}
+
+	//------------ render ------------
+
+	uint32_t frames = uint32_t(std::round(length * 48000.0f));
+	std::vector< float > audio(2 * size_t(frames));
+	uint64_t voices_mixed = 0;
+
+	auto before = std::chrono::high_resolution_clock::now();
+
+	//render a block at a time (so each Sound::render() call mixes exactly one block):
+	uint32_t rendered = 0;
+	auto next_event = events.begin();
+	while (rendered < frames) {
+		//issue all events that fall in the block about to be mixed:
+		double block_end = Sound::audio_clock() + double(Sound::block_size()) / 48000.0;
+		while (next_event != events.end() && next_event->time < block_end) {
+			next_event->run();
+			++next_event;
+		}
+		uint32_t count = std::min(frames - rendered, Sound::block_size());
+		Sound::render(audio.data() + 2 * size_t(rendered), count, &voices_mixed);
+		rendered += count;
+		Sound::stats(); //(collect block stats as we go, so the queue doesn't overflow)
+	}
+
+	auto after = std::chrono::high_resolution_clock::now();
+	double seconds = std::chrono::duration< double >(after - before).count();
+
+	Sound::Stats const &stats = Sound::stats();
+
+	Sound::shutdown();
+
+	//------------ report ------------
+
+	//(voices_mixed counts per block, so convert to an average using the block count):
+	uint64_t blocks = stats.blocks;
+	double average_voices = (blocks ? double(voices_mixed) / blocks : 0.0);
+	double realtime_factor = (seconds > 0.0 ? length / seconds : 0.0);
+
+	std::cout << "Rendered " << std::fixed << std::setprecision(3) << length << "s (" << events.size() << " events) in "
+	          << std::setprecision(4) << seconds << "s.\n";
+	std::cout << "  realtime factor: " << std::setprecision(1) << realtime_factor << "x\n";
+	std::cout << "  average voices mixed: " << std::setprecision(2) << average_voices << "\n";
+	std::cout << "  voices per core: " << std::setprecision(0) << average_voices * realtime_factor
+	          << " (average voices mixed x realtime factor)\n";
+	std::cout << "  slowest block: " << std::setprecision(3) << stats.max_mix_seconds * 1e3f << "ms"
+	          << " (of " << stats.deadline_seconds * 1e3f << "ms)\n";
+	std::cout << "  sample memory: " << cache.resident_bytes() / 1024 << "KiB (" << cache.entries.size() << " samples)\n";
+	std::cout << "  peak output: " << stats.peak << (stats.peak > 1.0f ? " (clipping!)" : "") << std::endl;
+
+	if (wav_file != "") {
+		save_wav(wav_file, audio, 2);
+		std::cout << "Wrote '" << wav_file << "'." << std::endl;
+	}
+
+	return 0;
+
+#ifdef _WIN32
+	} catch (std::exception const &e) {
+		std::cerr << "Unhandled exception:\n" << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cerr << "Unhandled exception (unknown type)." << std::endl;
+		return 1;
+	}
+#endif
+}
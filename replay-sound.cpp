@@ -0,0 +1,211 @@
+//replay-sound: renders a sound capture (see Sound::Settings::capture_file) with the offline mixer.
+// every captured command is sent again just before the block it took effect in, so the output matches the captured session exactly:
+// compare the output checksum (or '.wav' files) from before and after a mixer change to check that it didn't change the output,
+// or use the timing report to profile a real play session's mix without guessing at a synthetic workload.
+//
+//usage: replay-sound <capture> [out.wav]
+
+#include "Sound.hpp"
+#include "sound_capture.hpp"
+#include "load_wav.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+#include <algorithm>
+#include <memory>
+#include <map>
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+	//when compiled on windows, unhandled exceptions don't have their message printed, which can make debugging simple issues difficult.
+	try {
+#endif
+
+	if (argc != 2 && argc != 3) {
+		std::cerr << "Usage:\n\t" << argv[0] << " <capture> [out.wav]" << std::endl;
+		return 1;
+	}
+	std::string capture_file = argv[1];
+	std::string wav_file = (argc == 3 ? argv[2] : "");
+
+	Capture capture;
+	load_capture(capture_file, &capture);
+	if (!capture.ended) {
+		std::cerr << "WARNING: capture '" << capture_file << "' has no end (Sound::shutdown() wasn't called?); replaying up to its last command." << std::endl;
+	}
+
+	//mix with the captured session's settings:
+	Sound::Settings settings;
+	settings.open_device = false;
+	settings.max_voices = capture.settings.max_voices;
+	settings.max_real_voices = capture.settings.max_real_voices;
+	settings.block_size = capture.settings.block_size;
+	settings.mix_threads = capture.settings.mix_threads;
+	settings.far_radii = capture.settings.far_radii;
+	settings.buses = capture.settings.buses;
+	settings.ambisonic_buses = capture.settings.ambisonic_buses;
+	Sound::init(settings);
+
+	//(streams are opened from their original files)
+	std::vector< std::unique_ptr< Sound::Stream > > streams(capture.sources.size());
+	for (uint32_t id = 0; id < capture.sources.size(); ++id) {
+		if (!capture.sources[id].sample && capture.sources[id].stream != "") {
+			streams[id].reset(new Sound::Stream(capture.sources[id].stream));
+		}
+	}
+
+	//handles for voices played so far, by their captured (slot, generation):
+	std::map< std::pair< uint32_t, uint32_t >, Sound::PlayingSample > playing;
+	auto handle = [&playing](CaptureCommand const &command) -> Sound::PlayingSample const * {
+		auto f = playing.find(std::make_pair(command.slot, command.generation));
+		return (f == playing.end() ? nullptr : &f->second);
+	};
+	bool warned_effects = false;
+
+	auto run = [&](CaptureCommand const &command) {
+		Sound::PlayingSample const *voice = handle(command);
+		Sound::Bus bus;
+		bus.index = uint32_t(command.int_value);
+		switch (command.type) {
+			case CaptureCommand::Play: {
+				Sound::PlayingSample started;
+				double time = double(command.start) / 48000.0;
+				Capture::Source const *source = (command.source < capture.sources.size() ? &capture.sources[command.source] : nullptr);
+				if (source && source->sample) {
+					Sound::Sample const &sample = *source->sample;
+					if (command.pan == command.pan) {
+						started = (command.loop ? Sound::loop_at(sample, time, command.volume, command.pan) : Sound::play_at(sample, time, command.volume, command.pan));
+					} else {
+						started = (command.loop ? Sound::loop_3D_at(sample, time, command.volume, command.position, command.half_volume_radius)
+						                        : Sound::play_3D_at(sample, time, command.volume, command.position, command.half_volume_radius));
+					}
+				} else if (source && streams[command.source]) {
+					Sound::Stream &stream = *streams[command.source];
+					started = (command.loop ? Sound::loop(stream, command.volume, command.pan) : Sound::play(stream, command.volume, command.pan));
+				} else {
+					std::cerr << "WARNING: capture plays source " << command.source << ", which it doesn't include; skipping." << std::endl;
+				}
+				playing[std::make_pair(command.slot, command.generation)] = started;
+			} break;
+			case CaptureCommand::SetVolume:
+				if (voice) voice->set_volume(command.value, command.ramp);
+				break;
+			case CaptureCommand::SetPan:
+				if (voice) voice->set_pan(command.value, command.ramp);
+				break;
+			case CaptureCommand::SetPosition:
+				if (voice) voice->set_position(command.a, command.ramp);
+				break;
+			case CaptureCommand::SetHalfVolumeRadius:
+				if (voice) voice->set_half_volume_radius(command.value, command.ramp);
+				break;
+			case CaptureCommand::SetRate:
+				if (voice) voice->set_rate(command.value, command.ramp);
+				break;
+			case CaptureCommand::SetPriority:
+				if (voice) voice->set_priority(command.int_value);
+				break;
+			case CaptureCommand::SetBus:
+				if (voice) voice->set_bus(bus);
+				break;
+			case CaptureCommand::Stop:
+				if (voice) voice->stop(command.ramp);
+				break;
+			case CaptureCommand::StopAll:
+				Sound::stop_all_samples();
+				break;
+			case CaptureCommand::SetListener:
+				Sound::listener.set_position_right(command.a, command.b, command.ramp);
+				break;
+			case CaptureCommand::SetGlobalVolume:
+				Sound::set_volume(command.value, command.ramp);
+				break;
+			case CaptureCommand::SetBusVolume:
+				bus.set_volume(command.value, command.ramp);
+				break;
+			case CaptureCommand::SetBusEffects:
+				if (!warned_effects) {
+					std::cerr << "WARNING: the captured session changed bus effects, which aren't captured; output won't match from block " << command.block << " on." << std::endl;
+					warned_effects = true;
+				}
+				break;
+			case CaptureCommand::SetBlockSize:
+				Sound::set_block_size(uint32_t(command.int_value));
+				break;
+		}
+	};
+
+	//------------ render ------------
+
+	std::vector< float > audio; //(only kept if writing a '.wav')
+	std::vector< float > block(2 * 1024);
+	uint64_t frames = 0;
+	uint64_t checksum = 14695981039346656037ULL; //(64-bit FNV-1a of the output's bytes)
+	uint64_t voices_mixed = 0;
+
+	auto before = std::chrono::high_resolution_clock::now();
+
+	//render a block at a time, sending each block's commands just before it is mixed:
+	auto next = capture.commands.begin();
+	for (uint64_t b = 0; b < capture.blocks; ++b) {
+		while (next != capture.commands.end() && next->block <= b) {
+			run(*next);
+			++next;
+		}
+		uint32_t count = Sound::block_size();
+		block.resize(2 * size_t(count));
+		Sound::render(block.data(), count, &voices_mixed);
+		Sound::stats(); //(collect block stats as we go, so the queue doesn't overflow)
+
+		unsigned char const *bytes = reinterpret_cast< unsigned char const * >(block.data());
+		for (size_t i = 0; i < block.size() * sizeof(float); ++i) {
+			checksum = (checksum ^ bytes[i]) * 1099511628211ULL;
+		}
+		if (wav_file != "") audio.insert(audio.end(), block.begin(), block.end());
+		frames += count;
+	}
+
+	auto after = std::chrono::high_resolution_clock::now();
+	double seconds = std::chrono::duration< double >(after - before).count();
+
+	Sound::Stats const &stats = Sound::stats();
+
+	playing.clear();
+	Sound::shutdown();
+
+	//------------ report ------------
+
+	double length = double(frames) / 48000.0;
+	uint64_t blocks = stats.blocks;
+	double average_voices = (blocks ? double(voices_mixed) / blocks : 0.0);
+	double realtime_factor = (seconds > 0.0 ? length / seconds : 0.0);
+
+	std::cout << "Replayed " << std::fixed << std::setprecision(3) << length << "s (" << blocks << " blocks, "
+	          << capture.commands.size() << " commands, " << capture.sources.size() << " samples and streams) in "
+	          << std::setprecision(4) << seconds << "s.\n";
+	std::cout << "  realtime factor: " << std::setprecision(1) << realtime_factor << "x\n";
+	std::cout << "  average voices mixed: " << std::setprecision(2) << average_voices << "\n";
+	std::cout << "  slowest block: " << std::setprecision(3) << stats.max_mix_seconds * 1e3f << "ms"
+	          << " (of " << stats.deadline_seconds * 1e3f << "ms)\n";
+	std::cout << "  peak output: " << stats.peak << (stats.peak > 1.0f ? " (clipping!)" : "") << "\n";
+	std::cout << "  output checksum: " << std::hex << std::setw(16) << std::setfill('0') << checksum << std::dec << std::setfill(' ') << std::endl;
+
+	if (wav_file != "") {
+		save_wav(wav_file, audio, 2);
+		std::cout << "Wrote '" << wav_file << "'." << std::endl;
+	}
+
+	return 0;
+
+#ifdef _WIN32
+	} catch (std::exception const &e) {
+		std::cerr << "Unhandled exception:\n" << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cerr << "Unhandled exception (unknown type)." << std::endl;
+		return 1;
+	}
+#endif
+}
@@ -0,0 +1,98 @@
+#include "resample.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <cassert>
+#include <cmath>
+
+//filter design:
+static constexpr uint32_t const ZERO_CROSSINGS = 16; //sinc zero crossings on each side of the center (at the lower of the two rates)
+static constexpr uint32_t const MAX_PHASES = 4096; //phases stored (if there are more, the nearest is used)
+static constexpr double const KAISER_BETA = 8.0; //window shape (about 80dB stopband)
+static constexpr double const ROLLOFF = 0.94; //cutoff, as a fraction of the lower Nyquist frequency
+
+//zeroth-order modified Bessel function of the first kind (for the Kaiser window):
+static double bessel_i0(double x) {
+	double sum = 1.0;
+	double term = 1.0;
+	for (uint32_t k = 1; k < 50; ++k) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+		if (term < sum * 1e-12) break;
+	}
+	return sum;
+}
+
+void resample(std::vector< float > const &in, uint32_t in_rate, uint32_t out_rate, std::vector< float > *out_) {
+	assert(out_);
+	auto &out = *out_;
+	assert(in_rate > 0 && out_rate > 0);
+
+	if (in_rate == out_rate) {
+		out = in;
+		return;
+	}
+
+	//output sample n falls at input position n * M / L (an integer plus one of L fractions):
+	uint32_t g = std::gcd(in_rate, out_rate);
+	uint64_t L = out_rate / g;
+	uint64_t M = in_rate / g;
+	uint32_t phases = uint32_t(std::min< uint64_t >(L, MAX_PHASES));
+
+	//cutoff (in cycles per input sample) and filter length, widened when converting down:
+	double scale = std::min(1.0, double(out_rate) / double(in_rate));
+	double cutoff = 0.5 * scale * ROLLOFF;
+	int32_t half = int32_t(std::ceil(ZERO_CROSSINGS / scale));
+	int32_t taps = 2 * half;
+
+	//build filter table; phase p holds taps for input samples k0 - half + 1 .. k0 + half
+	// when the output is at input position k0 + p / phases:
+	std::vector< float > filter(size_t(phases) * taps);
+	double const pi = 3.14159265358979323846;
+	double window_norm = 1.0 / bessel_i0(KAISER_BETA);
+	for (uint32_t p = 0; p < phases; ++p) {
+		float *f = &filter[size_t(p) * taps];
+		double sum = 0.0;
+		for (int32_t j = 0; j < taps; ++j) {
+			double t = double(p) / phases + (half - 1 - j); //distance from output position to input sample
+			double x = t / half;
+			double window = (std::abs(x) < 1.0 ? bessel_i0(KAISER_BETA * std::sqrt(1.0 - x * x)) * window_norm : 0.0);
+			double arg = 2.0 * cutoff * t;
+			double sinc = (arg == 0.0 ? 1.0 : std::sin(pi * arg) / (pi * arg));
+			double h = 2.0 * cutoff * sinc * window;
+			f[j] = float(h);
+			sum += h;
+		}
+		//normalize so every phase passes DC unchanged:
+		for (int32_t j = 0; j < taps; ++j) {
+			f[j] = float(f[j] / sum);
+		}
+	}
+
+	//run filter:
+	uint64_t count = (uint64_t(in.size()) * L + M - 1) / M;
+	out.assign(count, 0.0f);
+	int64_t size = int64_t(in.size());
+	for (uint64_t n = 0; n < count; ++n) {
+		uint64_t position = n * M;
+		int64_t k0 = int64_t(position / L);
+		uint32_t phase = uint32_t(((position % L) * phases) / L);
+		float const *f = &filter[size_t(phase) * taps];
+		int64_t first = k0 - half + 1;
+
+		float acc = 0.0f;
+		if (first >= 0 && first + taps <= size) {
+			float const *src = in.data() + first;
+			for (int32_t j = 0; j < taps; ++j) {
+				acc += f[j] * src[j];
+			}
+		} else {
+			//near the ends, samples outside the input are zero:
+			for (int32_t j = 0; j < taps; ++j) {
+				int64_t k = first + j;
+				if (k >= 0 && k < size) acc += f[j] * in[size_t(k)];
+			}
+		}
+		out[n] = acc;
+	}
+}
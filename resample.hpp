@@ -0,0 +1,12 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+//Band-limited sample rate conversion, used when loading audio that isn't already 48kHz.
+//Uses a polyphase windowed-sinc (Kaiser) filter: each output sample is a short FIR over the input samples
+// around it, with filter taps chosen by where the output falls between input samples (its "phase").
+//When converting down, the filter's cutoff is lowered to the output's Nyquist frequency, so nothing aliases.
+
+//convert mono audio 'in' from 'in_rate' to 'out_rate' (both in Hz) into *out (replacing its contents):
+void resample(std::vector< float > const &in, uint32_t in_rate, uint32_t out_rate, std::vector< float > *out);
@@ -0,0 +1,274 @@
+#include "sound_capture.hpp"
+
+#include <iostream>
+#include <stdexcept>
+#include <type_traits>
+#include <cstring>
+#include <cassert>
+
+//identifies capture files (and the version of the format):
+static char const MAGIC[8] = {'s', 'n', 'd', 'c', 'a', 'p', '0', '1'};
+
+//record kinds:
+enum Record : uint8_t {
+	SampleRecord = 1, //id, format, length, stored data
+	StreamRecord = 2, //id, filename
+	BlockRecord = 3, //block index
+	CommandRecord = 4, //type, then the fields the type uses (see command_fields)
+	EndRecord = 5, //blocks mixed
+};
+
+//helpers: values are written and read as their bytes (bools as one byte; strings as a length and then their characters):
+template< typename T >
+static void write_value(std::ostream &out, T const &value) {
+	static_assert(std::is_trivially_copyable< T >::value, "values are written as bytes");
+	out.write(reinterpret_cast< char const * >(&value), sizeof(T));
+}
+static void write_value(std::ostream &out, bool value) {
+	write_value(out, uint8_t(value ? 1 : 0));
+}
+static void write_value(std::ostream &out, std::string const &value) {
+	write_value(out, uint32_t(value.size()));
+	out.write(value.data(), value.size());
+}
+
+template< typename T >
+static void read_value(std::istream &in, T *value) {
+	static_assert(std::is_trivially_copyable< T >::value, "values are read as bytes");
+	in.read(reinterpret_cast< char * >(value), sizeof(T));
+}
+static void read_value(std::istream &in, bool *value) {
+	uint8_t byte = 0;
+	read_value(in, &byte);
+	*value = (byte != 0);
+}
+static void read_value(std::istream &in, std::string *value) {
+	uint32_t size = 0;
+	read_value(in, &size);
+	value->resize(size);
+	in.read(&(*value)[0], size);
+}
+
+//helper: call 'f' on each field of 'command' that its type uses, in file order
+// (used for both writing and reading, so the two always agree):
+template< typename C, typename F >
+static void command_fields(C &command, F const &f) {
+	switch (command.type) {
+		case CaptureCommand::Play:
+			f(command.slot); f(command.generation);
+			f(command.source); f(command.loop); f(command.start); f(command.volume); f(command.pan);
+			if (!(command.pan == command.pan)) {
+				f(command.position); f(command.half_volume_radius);
+			}
+			break;
+		case CaptureCommand::SetVolume:
+		case CaptureCommand::SetPan:
+		case CaptureCommand::SetHalfVolumeRadius:
+		case CaptureCommand::SetRate:
+			f(command.slot); f(command.generation); f(command.value); f(command.ramp);
+			break;
+		case CaptureCommand::SetPosition:
+			f(command.slot); f(command.generation); f(command.a); f(command.ramp);
+			break;
+		case CaptureCommand::SetPriority:
+		case CaptureCommand::SetBus:
+			f(command.slot); f(command.generation); f(command.int_value);
+			break;
+		case CaptureCommand::Stop:
+			f(command.slot); f(command.generation); f(command.ramp);
+			break;
+		case CaptureCommand::StopAll:
+			break;
+		case CaptureCommand::SetListener:
+			f(command.a); f(command.b); f(command.ramp);
+			break;
+		case CaptureCommand::SetGlobalVolume:
+			f(command.value); f(command.ramp);
+			break;
+		case CaptureCommand::SetBusVolume:
+			f(command.int_value); f(command.value); f(command.ramp);
+			break;
+		case CaptureCommand::SetBusEffects:
+		case CaptureCommand::SetBlockSize:
+			f(command.int_value);
+			break;
+	}
+}
+
+//------------------------------------------------
+
+CaptureWriter::CaptureWriter(std::string const &filename_, CaptureSettings const &settings) : filename(filename_), out(filename_, std::ios::binary) {
+	if (!out) throw std::runtime_error("Failed to open sound capture '" + filename + "' for writing.");
+
+	out.write(MAGIC, sizeof(MAGIC));
+	write_value(out, settings.max_voices);
+	write_value(out, settings.max_real_voices);
+	write_value(out, settings.block_size);
+	write_value(out, settings.mix_threads);
+	write_value(out, settings.far_radii);
+	write_value(out, uint32_t(settings.buses.size()));
+	for (auto const &bus : settings.buses) {
+		write_value(out, bus.first);
+		write_value(out, bus.second);
+	}
+	write_value(out, uint32_t(settings.ambisonic_buses.size()));
+	for (auto const &name : settings.ambisonic_buses) {
+		write_value(out, name);
+	}
+}
+
+void CaptureWriter::sample(uint32_t id, Sound::Sample const &sample) {
+	assert(!sample.loading && "samples are written once loaded");
+	write_value(out, uint8_t(SampleRecord));
+	write_value(out, id);
+	write_value(out, uint8_t(sample.format));
+	write_value(out, sample.length);
+	if (sample.format == Sound::Sample::Float32) {
+		out.write(reinterpret_cast< char const * >(sample.floats()), sample.length * sizeof(float));
+	} else if (sample.format == Sound::Sample::Int16) {
+		out.write(reinterpret_cast< char const * >(sample.data16.data()), sample.length * sizeof(int16_t));
+	} else {
+		assert(sample.format == Sound::Sample::ADPCM);
+		write_value(out, uint32_t(sample.adpcm.size()));
+		out.write(reinterpret_cast< char const * >(sample.adpcm.data()), sample.adpcm.size());
+	}
+}
+
+void CaptureWriter::stream(uint32_t id, std::string const &stream_filename) {
+	write_value(out, uint8_t(StreamRecord));
+	write_value(out, id);
+	write_value(out, stream_filename);
+}
+
+void CaptureWriter::command(CaptureCommand const &command) {
+	if (command.block != block) {
+		write_value(out, uint8_t(BlockRecord));
+		write_value(out, command.block);
+		block = command.block;
+	}
+	write_value(out, uint8_t(CommandRecord));
+	write_value(out, command.type);
+	command_fields(command, [this](auto const &field) {
+		write_value(out, field);
+	});
+}
+
+void CaptureWriter::end(uint64_t blocks) {
+	write_value(out, uint8_t(EndRecord));
+	write_value(out, blocks);
+	out.flush();
+	if (!out) {
+		std::cerr << "WARNING: failed to write sound capture '" << filename << "'; it may be incomplete." << std::endl;
+	}
+}
+
+//------------------------------------------------
+
+void load_capture(std::string const &filename, Capture *capture_) {
+	assert(capture_);
+	auto &capture = *capture_;
+	capture = Capture();
+
+	std::ifstream in(filename, std::ios::binary);
+	if (!in) throw std::runtime_error("Failed to open sound capture '" + filename + "'.");
+
+	char magic[sizeof(MAGIC)];
+	in.read(magic, sizeof(magic));
+	if (!in || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0) {
+		throw std::runtime_error("'" + filename + "' isn't a sound capture (or is from another version of the format).");
+	}
+
+	CaptureSettings &settings = capture.settings;
+	read_value(in, &settings.max_voices);
+	read_value(in, &settings.max_real_voices);
+	read_value(in, &settings.block_size);
+	read_value(in, &settings.mix_threads);
+	read_value(in, &settings.far_radii);
+	uint32_t count = 0;
+	read_value(in, &count);
+	for (uint32_t i = 0; i < count && in; ++i) {
+		settings.buses.emplace_back();
+		read_value(in, &settings.buses.back().first);
+		read_value(in, &settings.buses.back().second);
+	}
+	count = 0;
+	read_value(in, &count);
+	for (uint32_t i = 0; i < count && in; ++i) {
+		settings.ambisonic_buses.emplace_back();
+		read_value(in, &settings.ambisonic_buses.back());
+	}
+	if (!in) throw std::runtime_error("Sound capture '" + filename + "' has a truncated header.");
+
+	//helper: the source with id 'id' (making room for it):
+	auto source = [&capture](uint32_t id) -> Capture::Source & {
+		if (id >= capture.sources.size()) capture.sources.resize(size_t(id) + 1);
+		return capture.sources[id];
+	};
+
+	uint64_t block = 0;
+	for (;;) {
+		uint8_t kind = 0;
+		read_value(in, &kind);
+		if (!in) break; //(end of file)
+
+		if (kind == SampleRecord) {
+			uint32_t id = 0;
+			uint8_t format = 0;
+			std::unique_ptr< Sound::Sample > sample(new Sound::Sample);
+			read_value(in, &id);
+			read_value(in, &format);
+			read_value(in, &sample->length);
+			if (format == Sound::Sample::Float32) {
+				sample->data.resize(sample->length);
+				in.read(reinterpret_cast< char * >(sample->data.data()), sample->length * sizeof(float));
+			} else if (format == Sound::Sample::Int16) {
+				sample->data16.resize(sample->length);
+				in.read(reinterpret_cast< char * >(sample->data16.data()), sample->length * sizeof(int16_t));
+			} else if (format == Sound::Sample::ADPCM) {
+				uint32_t bytes = 0;
+				read_value(in, &bytes);
+				sample->adpcm.resize(bytes);
+				in.read(reinterpret_cast< char * >(sample->adpcm.data()), bytes);
+			} else {
+				throw std::runtime_error("Sound capture '" + filename + "' has a sample in unknown format " + std::to_string(format) + ".");
+			}
+			sample->format = Sound::Sample::Format(format);
+			if (in) source(id).sample = std::move(sample);
+		} else if (kind == StreamRecord) {
+			uint32_t id = 0;
+			std::string stream;
+			read_value(in, &id);
+			read_value(in, &stream);
+			if (in) source(id).stream = stream;
+		} else if (kind == BlockRecord) {
+			read_value(in, &block);
+		} else if (kind == CommandRecord) {
+			CaptureCommand command;
+			read_value(in, &command.type);
+			if (command.type > CaptureCommand::SetBlockSize) {
+				throw std::runtime_error("Sound capture '" + filename + "' has a command of unknown type " + std::to_string(int(command.type)) + ".");
+			}
+			command.block = block;
+			command_fields(command, [&in](auto &field) {
+				read_value(in, &field);
+			});
+			if (in) capture.commands.emplace_back(command);
+		} else if (kind == EndRecord) {
+			read_value(in, &capture.blocks);
+			if (in) capture.ended = true;
+			break;
+		} else {
+			throw std::runtime_error("Sound capture '" + filename + "' has a record of unknown kind " + std::to_string(int(kind)) + ".");
+		}
+
+		if (!in) {
+			//(e.g., the game crashed before the capture was written out)
+			std::cerr << "WARNING: sound capture '" << filename << "' ends partway through a record; using the records before it." << std::endl;
+			break;
+		}
+	}
+
+	if (!capture.ended) {
+		capture.blocks = (capture.commands.empty() ? 0 : capture.commands.back().block + 1);
+	}
+}
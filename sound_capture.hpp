@@ -0,0 +1,112 @@
+#pragma once
+
+/*
+ * Sound captures record every command sent to the mixer -- plays, set_*, stops, listener and volume changes --
+ * each stamped with the index of the block it took effect in (see Sound::Settings::capture_file).
+ * Replaying a capture through the offline mixer (see replay-sound.cpp) gives exactly the same output, block for block,
+ * so a real play session can be rendered again to compare mixer changes bit-for-bit, or to profile the mixer offline.
+ *
+ * A capture file is a header (the Settings that change what the mixer outputs) followed by records,
+ * each a one-byte kind and then its fields:
+ *  - Source: a sample's stored data, or a stream's filename (written the first time it is played)
+ *  - Block: index of the block the commands after it took effect in (written when it changes)
+ *  - Command: a CaptureCommand (just the fields its type uses)
+ *  - End: the number of blocks mixed (written by Sound::shutdown())
+ * Values are stored in the machine's byte order.
+ *
+ * Not captured: changes made directly to Sound::volume or Sound::listener (under Sound::lock()), Stream::seek(), and bus effects.
+ * Samples that were still loading when played are replayed as if they had loaded, and streams as if they never fell behind.
+ *
+ */
+
+#include "Sound.hpp"
+
+#include <glm/glm.hpp>
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+//the mixer settings recorded in a capture's header:
+struct CaptureSettings {
+	uint32_t max_voices = 0;
+	uint32_t max_real_voices = 0;
+	uint32_t block_size = 0; //(at the start of the capture)
+	uint32_t mix_threads = 0; //(voices are summed in a different order with a different number of threads)
+	float far_radii = 0.0f;
+	std::vector< std::pair< std::string, std::string > > buses;
+	std::vector< std::string > ambisonic_buses;
+};
+
+//one command, as applied by the mixer:
+struct CaptureCommand {
+	//(listed in the same order as the mixer's own commands)
+	enum Type : uint8_t {
+		Play, //start playing: 'source' with the starting state below (on handle 'slot', 'generation')
+		SetVolume, //set a voice's volume to 'value' over 'ramp'
+		SetPan, //set a voice's pan to 'value' over 'ramp'
+		SetPosition, //set a voice's position to 'a' over 'ramp'
+		SetHalfVolumeRadius, //set a voice's half volume radius to 'value' over 'ramp'
+		SetRate, //set a voice's playback rate to 'value' over 'ramp'
+		SetPriority, //set a voice's priority to 'int_value'
+		SetBus, //mix a voice into bus 'int_value' (an index into the buses, as set up by Sound::init())
+		Stop, //stop a voice over 'ramp'
+		StopAll, //stop all playing voices
+		SetListener, //set listener position to 'a' and right to 'b' over 'ramp'
+		SetGlobalVolume, //set Sound::volume to 'value' over 'ramp'
+		SetBusVolume, //set volume of bus 'int_value' to 'value' over 'ramp'
+		SetBusEffects, //effects of bus 'int_value' were changed (not replayable)
+		SetBlockSize, //block size is 'int_value' from this block on (see Sound::set_block_size())
+	} type = Play;
+	uint64_t block = 0; //block the command took effect in
+	uint32_t slot = -1U; //voice the command applies to (if any), as the handle was numbered when captured...
+	uint32_t generation = 0; //...and that handle's generation
+	int32_t int_value = 0;
+	glm::vec3 a = glm::vec3(0.0f);
+	glm::vec3 b = glm::vec3(0.0f);
+	float value = 0.0f;
+	float ramp = 0.0f;
+
+	//Play only:
+	uint32_t source = -1U; //sample or stream being played (see Capture::sources)
+	bool loop = false;
+	uint64_t start = 0; //audio clock time (in samples) to start at (0 means right away)
+	float volume = 1.0f;
+	float pan = 0.0f; //NaN for 3D voices...
+	glm::vec3 position = glm::vec3(0.0f); //...which use these instead
+	float half_volume_radius = 0.0f;
+};
+
+//writes a capture file (used by the mixer; game thread only):
+struct CaptureWriter {
+	//create 'filename' and write the header; throws on error:
+	CaptureWriter(std::string const &filename, CaptureSettings const &settings);
+
+	void sample(uint32_t id, Sound::Sample const &sample); //(a sample that is done loading)
+	void stream(uint32_t id, std::string const &filename);
+	void command(CaptureCommand const &command);
+	void end(uint64_t blocks);
+
+	std::string filename;
+	std::ofstream out;
+	uint64_t block = -1ULL; //block of the last Block record
+};
+
+//a whole capture file, read back:
+struct Capture {
+	CaptureSettings settings;
+	struct Source {
+		std::unique_ptr< Sound::Sample > sample; //(if a sample)
+		std::string stream; //(if a stream) filename to open
+	};
+	std::vector< Source > sources; //(by id)
+	std::vector< CaptureCommand > commands; //(in the order applied)
+	uint64_t blocks = 0; //blocks mixed while capturing
+	bool ended = false; //did the capture have an End record? (if not -- e.g., the game crashed -- 'blocks' runs to the last command)
+};
+
+//read a capture file; throws on error:
+void load_capture(std::string const &filename, Capture *capture);